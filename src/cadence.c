@@ -0,0 +1,179 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <string.h>
+#include <gst/gstinfo.h>
+
+#include "cadence.h"
+
+GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
+#define GST_CAT_DEFAULT gst_aml_vsink_debug
+
+/* need this many deltas before reporting */
+#define CADENCE_MIN_SAMPLES 8
+/* larger gap is a discontinuity, not a frame */
+#define CADENCE_MAX_DELTA_NS 200000000ULL
+
+/* fps * 100 */
+static const int std_rates[] = {2397, 2400, 2500, 2997, 3000, 5000, 5994, 6000};
+
+void cadence_reset(struct cadence *c)
+{
+  memset (c, 0, sizeof(*c));
+}
+
+static uint64_t median(const uint64_t *v, int n)
+{
+  uint64_t s[CADENCE_WINDOW];
+  int i, j;
+
+  /* insertion sort, n is small */
+  for (i = 0; i < n; i++) {
+    uint64_t x = v[i];
+
+    for (j = i; j > 0 && s[j - 1] > x; j--)
+      s[j] = s[j - 1];
+    s[j] = x;
+  }
+  return s[n / 2];
+}
+
+static uint64_t rate_to_ns(int rate)
+{
+  return 100000000000ULL / rate;
+}
+
+/* snap to standard rate within 1.5% */
+static int snap_rate(uint64_t ns)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(std_rates) / sizeof(std_rates[0])); i++) {
+    uint64_t ref = rate_to_ns (std_rates[i]);
+    uint64_t diff = ns > ref ? ns - ref : ref - ns;
+
+    if (diff * 1000 < ref * 15)
+      return std_rates[i];
+  }
+  return (int)(100000000000ULL / ns);
+}
+
+static bool near(uint64_t a, uint64_t b)
+{
+  uint64_t diff = a > b ? a - b : b - a;
+
+  return diff * 100 < b * 5;
+}
+
+/* deltas alternate between x and 1.5x, e.g. 33.4/50.0 ms of
+ * 23.976 film telecined to 59.94 fields
+ */
+static void detect_pulldown(struct cadence *c)
+{
+  uint64_t lo = (uint64_t)-1, hi = 0;
+  int i, alt = 0;
+  /* oldest delta */
+  int start = c->cnt < CADENCE_WINDOW ? 0 : c->idx;
+
+  for (i = 0; i < c->cnt; i++) {
+    if (c->delta[i] < lo)
+      lo = c->delta[i];
+    if (c->delta[i] > hi)
+      hi = c->delta[i];
+  }
+
+  c->pulldown = false;
+  if (!near (hi * 2, lo * 3))
+    return;
+
+  for (i = 1; i < c->cnt; i++) {
+    uint64_t prev = c->delta[(start + i - 1) % CADENCE_WINDOW];
+    uint64_t cur = c->delta[(start + i) % CADENCE_WINDOW];
+
+    if ((near (prev, lo) && near (cur, hi)) || (near (prev, hi) && near (cur, lo)))
+      alt++;
+  }
+  /* allow a miss or two, 2:3 cadence has no repeat every 5th step */
+  if (alt >= c->cnt - 3) {
+    c->pulldown = true;
+    c->short_ns = lo;
+    c->long_ns = hi;
+  }
+}
+
+void cadence_push(struct cadence *c, uint64_t ts_ns)
+{
+  uint64_t d;
+  int rate;
+  bool pulldown;
+
+  if (!c->last_ts_set || ts_ns <= c->last_ts) {
+    if (c->last_ts_set)
+      GST_DEBUG ("cadence reset on ts %llu", ts_ns);
+    cadence_reset (c);
+    c->last_ts = ts_ns;
+    c->last_ts_set = true;
+    return;
+  }
+
+  d = ts_ns - c->last_ts;
+  c->last_ts = ts_ns;
+  if (d > CADENCE_MAX_DELTA_NS)
+    return;
+
+  c->delta[c->idx] = d;
+  c->idx = (c->idx + 1) % CADENCE_WINDOW;
+  if (c->cnt < CADENCE_WINDOW)
+    c->cnt++;
+  if (c->cnt < CADENCE_MIN_SAMPLES)
+    return;
+
+  pulldown = c->pulldown;
+  detect_pulldown (c);
+  if (c->pulldown) {
+    /* 2 frames every 5 fields */
+    c->frame_ns = (c->short_ns + c->long_ns) / 2;
+    rate = snap_rate (c->frame_ns);
+  } else {
+    c->frame_ns = median (c->delta, c->cnt);
+    rate = snap_rate (c->frame_ns);
+  }
+
+  if (rate != c->rate || pulldown != c->pulldown)
+    GST_INFO ("cadence %d.%02d fps%s", rate / 100, rate % 100,
+        c->pulldown ? " 2:3 pulldown" : "");
+  c->rate = rate;
+}
+
+uint32_t cadence_duration_90k(struct cadence *c)
+{
+  uint64_t ns;
+
+  if (!c->rate)
+    return 0;
+
+  if (c->pulldown) {
+    /* alternate with last delta */
+    uint64_t last = c->delta[(c->idx + CADENCE_WINDOW - 1) % CADENCE_WINDOW];
+
+    ns = near (last, c->short_ns) ? c->long_ns : c->short_ns;
+  } else {
+    ns = rate_to_ns (c->rate);
+  }
+  return (uint32_t)(ns * 9 / 100000);
+}
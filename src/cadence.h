@@ -0,0 +1,52 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef _CADENCE_H_
+#define _CADENCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CADENCE_WINDOW 16
+
+/* frame cadence from decoded frame timestamps, so pacing does not
+ * depend on framerate in caps
+ */
+struct cadence {
+  uint64_t last_ts;
+  bool last_ts_set;
+  /* recent timestamp deltas in ns */
+  uint64_t delta[CADENCE_WINDOW];
+  int cnt;
+  int idx;
+
+  /* fps * 100 of median delta, 0 when unknown */
+  int rate;
+  uint64_t frame_ns;
+  /* 2:3 field repeat, deltas alternate between 2 and 3 fields */
+  bool pulldown;
+  uint64_t short_ns;
+  uint64_t long_ns;
+};
+
+void cadence_reset(struct cadence *c);
+/* feed timestamp of decoded frame in display order, ns */
+void cadence_push(struct cadence *c, uint64_t ts_ns);
+/* duration of next frame in 90K, 0 when cadence is unknown */
+uint32_t cadence_duration_90k(struct cadence *c);
+#endif
@@ -0,0 +1,184 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <gst/gst.h>
+
+#include "dec-pool.h"
+
+GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
+#define GST_CAT_DEFAULT gst_aml_vsink_debug
+
+struct pool_entry {
+  int fd;
+  struct dec_cfg cfg;
+};
+
+static GMutex pool_lock;
+static struct pool_entry pool[DEC_POOL_MAX];
+static int pool_cnt;
+static int pool_size;
+static struct dec_cfg last_cfg;
+static bool refill_running;
+
+bool dec_cfg_equal(const struct dec_cfg *a, const struct dec_cfg *b)
+{
+  return a->format == b->format &&
+    a->width == b->width &&
+    a->height == b->height &&
+    a->dw_mode == b->dw_mode &&
+    a->secure == b->secure &&
+    a->low_latency == b->low_latency &&
+    a->only_2k == b->only_2k &&
+    a->ext_ctrls == b->ext_ctrls &&
+    a->frame_rate == b->frame_rate &&
+    hdr_meta_equal (&a->hdr, &b->hdr);
+}
+
+static void close_decoder(int fd)
+{
+  v4l_unreg_event (fd);
+  close (fd);
+}
+
+static int open_standby(const struct dec_cfg *cfg)
+{
+  struct hdr_meta hdr = cfg->hdr;
+  int fd;
+
+  fd = v4l_dec_open (true);
+  if (fd < 0)
+    return -1;
+  if (v4l_reg_event (fd)) {
+    close (fd);
+    return -1;
+  }
+  if (!cfg->format)
+    return fd;
+
+  if (v4l_set_secure_mode (fd, cfg->width, cfg->height, cfg->secure) ||
+      v4l_dec_dw_config (fd, cfg->format, cfg->dw_mode, cfg->low_latency,
+        cfg->only_2k, cfg->frame_rate, &hdr, cfg->ext_ctrls) ||
+      v4l_set_output_format (fd, cfg->format, cfg->width, cfg->height,
+        cfg->only_2k)) {
+    GST_WARNING ("config standby decoder fail");
+    close_decoder (fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* pool_lock held, drop standby decoders configured for older streams */
+static void drop_stale(void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < pool_cnt; i++) {
+    if (i < pool_size && dec_cfg_equal (&pool[i].cfg, &last_cfg))
+      pool[n++] = pool[i];
+    else
+      close_decoder (pool[i].fd);
+  }
+  pool_cnt = n;
+}
+
+static gpointer refill_thread(gpointer data)
+{
+  struct dec_cfg cfg;
+  int fd;
+
+  prctl (PR_SET_NAME, "aml_dec_pool");
+  g_mutex_lock (&pool_lock);
+  while (pool_cnt < pool_size) {
+    gint64 start = g_get_monotonic_time ();
+
+    cfg = last_cfg;
+    g_mutex_unlock (&pool_lock);
+    fd = open_standby (&cfg);
+    g_mutex_lock (&pool_lock);
+    if (fd < 0)
+      break;
+
+    /* stream or size changed while opening */
+    if (pool_cnt >= pool_size || !dec_cfg_equal (&cfg, &last_cfg)) {
+      close_decoder (fd);
+      continue;
+    }
+    pool[pool_cnt].fd = fd;
+    pool[pool_cnt].cfg = cfg;
+    pool_cnt++;
+    GST_INFO ("standby decoder %d fmt %x ready in %lld us, %d/%d",
+        fd, cfg.format, g_get_monotonic_time () - start, pool_cnt, pool_size);
+  }
+  refill_running = false;
+  g_mutex_unlock (&pool_lock);
+  return NULL;
+}
+
+/* pool_lock held */
+static void refill(void)
+{
+  GThread *thread;
+
+  if (refill_running || pool_cnt >= pool_size)
+    return;
+  thread = g_thread_try_new ("aml_dec_pool", refill_thread, NULL, NULL);
+  if (!thread) {
+    GST_ERROR ("create pool thread fail");
+    return;
+  }
+  refill_running = true;
+  g_thread_unref (thread);
+}
+
+void dec_pool_set_size(int size)
+{
+  g_mutex_lock (&pool_lock);
+  pool_size = CLAMP (size, 0, DEC_POOL_MAX);
+  drop_stale ();
+  refill ();
+  g_mutex_unlock (&pool_lock);
+}
+
+int dec_pool_get(struct dec_cfg *cfg)
+{
+  int fd = -1;
+
+  g_mutex_lock (&pool_lock);
+  if (pool_cnt) {
+    pool_cnt--;
+    fd = pool[pool_cnt].fd;
+    *cfg = pool[pool_cnt].cfg;
+  }
+  refill ();
+  g_mutex_unlock (&pool_lock);
+  return fd;
+}
+
+void dec_pool_update(const struct dec_cfg *cfg)
+{
+  g_mutex_lock (&pool_lock);
+  if (!dec_cfg_equal (cfg, &last_cfg)) {
+    last_cfg = *cfg;
+    drop_stale ();
+  }
+  refill ();
+  g_mutex_unlock (&pool_lock);
+}
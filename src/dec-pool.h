@@ -0,0 +1,52 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef _DEC_POOL_H_
+#define _DEC_POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "v4l-dec.h"
+
+#define DEC_POOL_MAX 2
+
+/* what is applied to OUTPUT port before REQBUFS */
+struct dec_cfg {
+  uint32_t format;
+  int width;
+  int height;
+  uint32_t dw_mode;
+  bool secure;
+  bool low_latency;
+  bool only_2k;
+  bool ext_ctrls;
+  int frame_rate;
+  struct hdr_meta hdr;
+};
+
+bool dec_cfg_equal(const struct dec_cfg *a, const struct dec_cfg *b);
+
+/* process wide, 0 closes standby decoders */
+void dec_pool_set_size(int size);
+/* standby decoder opened with events registered, -1 when empty.
+ * cfg gets what the fd is configured with, format 0 for none
+ */
+int dec_pool_get(struct dec_cfg *cfg);
+/* most recent stream, standby decoders are configured for it */
+void dec_pool_update(const struct dec_cfg *cfg);
+#endif
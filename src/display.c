@@ -33,6 +33,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
+#include <time.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -50,22 +51,64 @@
 GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
 #define GST_CAT_DEFAULT gst_aml_vsink_debug
 
+/* vsyncs avsync holds a frame before release */
+#define AVSYNC_VSYNC_DELAY (2)
+/* frames kept by display thread before fence can be retrieved */
+#define POST_DELAY_FRAMES (2)
+#define DEFAULT_VSYNC_PERIOD_NS (16666667)
+
 enum {
   BF_INVALID = 0,
   BF_WAIT_AV_SYNC,
   BF_WAIT_RENDER,
 };
 
+/* destination geometry set by UI threads */
+struct disp_geometry {
+  struct rect dst_win;
+  /* source window of frame on screen, from display_engine_refresh */
+  struct rect refresh_src;
+  uint32_t refresh_gen;
+
+  /* window animation, interpolated on every vblank */
+  bool anim_active;
+  struct rect anim_from;
+  uint64_t anim_start_ns;
+  uint64_t anim_duration_ns;
+  int anim_easing;
+};
+
 struct video_disp {
   struct drm_display *drm;
   bool last_frame;
   int drm_mode_set;
   void *priv;
   pthread_mutex_t avsync_lock;
+
+  /* callbacks to element owning this handle */
+  displayed_cb_func display_cb;
+  pause_cb_func pause_cb;
+  underflow_cb_func underflow_cb;
+  eos_cb_func eos_cb;
+
+  /* eos fires once every pushed frame is done and the last one
+   * is on screen
+   */
+  gint eos_pending;
+  gint frames_pushed;
+  gint frames_done;
+
   uint32_t pause_pts;
   bool check_underflow;
+  /* allocated on first use in buffer mode */
   struct drm_frame *black_frame;
   int black_frame_pending;
+  int black_frame_mode;
+  /* null framebuffer commit that turns video plane off */
+  struct drm_buf plane_off_buf;
+  /* driver rejected plane off, use black buffer from then on */
+  gint plane_off_broken;
+  bool pip;
   struct drm_frame *cur_frame;
 
 
@@ -77,36 +120,109 @@ struct video_disp {
   void * avsync;
   int session;
   bool paused;
+  int extra_delay_ms;
 
-  /* low latency mode */
+  /* measured vblank period */
+  gint vsync_period_ns;
+
+  /* frame on screen, seqlock published by display thread */
+  uint32_t pos_seq;
+  uint64_t pos_ts;
+  uint64_t pos_vsync_ns;
+  uint32_t pos_duration;
+
+  /* low latency mode, policy and stats under fq_lock */
   bool low_latency;
   GQueue *fq;
   pthread_mutex_t fq_lock;
+  int ll_policy;
+  guint ll_depth;
+  uint64_t ll_deadline_ns;
+  /* smallest arrival - timestamp seen, maps timestamp to now */
+  int64_t ll_base;
+  bool ll_base_set;
+  struct ll_stats ll_stats;
+  uint64_t ll_latency_sum;
+
+  /* video plane scans out AFBC */
+  bool afbc_scanout;
 
   /* display thread */
   bool disp_started;
   pthread_t disp_t;
+  bool shared;
+
+  /* vsync state, owned by display thread */
+  struct drm_frame *f_old;
+  struct drm_frame *f_flip;
+  bool first_frame_rendered;
+  int last_vsync_cnt;
 
   /* recycle thread */
   void * recycle_q;
   bool recycle_started;
   pthread_t recycle_t;
 
-  /* scaling setting */
-  GRWLock scale_lock;
-  struct rect dst_win;
+  /* scaling setting, seqlock: writers serialized by geo_lock,
+   * display thread reads without blocking
+   */
+  pthread_mutex_t geo_lock;
+  uint32_t geo_seq;
+  struct disp_geometry geo;
+  gint geometry_pending;
+  /* last consistent snapshot and last committed window,
+   * owned by display thread
+   */
+  struct disp_geometry geo_last;
+  struct rect win_last;
+
+  /* geometry state owned by display thread */
+  uint32_t refresh_gen_used;
+  uint64_t anim_done_start;
+  /* CLOCK_MONOTONIC time of last vblank */
+  uint64_t vsync_ns;
+};
+
+enum {
+  DISP_STEP_IDLE = 0,
+  DISP_STEP_REPEAT,
+  DISP_STEP_POSTED,
+  DISP_STEP_LAST,
 };
 
+/* process wide display engine shared by refcount */
+struct display_core {
+  pthread_mutex_t lock;
+  int refcnt;
+  struct drm_display *drm;
+  gint vsync_period_ns;
+
+  /* registered planes, protected by lock */
+  GList *disps;
+  /* planes unlinked by the thread, being released outside lock */
+  GList *finishing;
+  /* signals plane attach, engine stop and finish done */
+  pthread_cond_t cond;
+  bool started;
+  pthread_t disp_t;
+};
+
+static struct display_core g_core = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+/* serialize engine get/put, held across thread join */
+static pthread_mutex_t g_core_ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static struct drm_frame* create_black_frame (void* handle,
     unsigned int width, unsigned int height, bool pip);
 static void destroy_black_frame (struct drm_frame *frame);
 static int frame_destroy(struct drm_frame* drm_f);
 static void * display_thread_func(void * arg);
+static void * shared_display_thread_func(void * arg);
 static void * recycle_thread_func(void * arg);
-
-displayed_cb_func display_cb;
-pause_cb_func pause_cb;
-underflow_cb_func underflow_cb;
+static void display_vsync_finish(struct video_disp *disp);
+static void display_vsync_reset(struct video_disp *disp);
 
 static void display_res_change_cb(void *p)
 {
@@ -115,7 +231,211 @@ static void display_res_change_cb(void *p)
   return;
 }
 
-void *display_engine_start(void* priv, bool pip, bool low_latency)
+static struct drm_display *display_core_get(void)
+{
+  struct drm_display *drm;
+
+  pthread_mutex_lock (&g_core_ref_lock);
+  if (!g_core.drm) {
+    g_core.drm = drm_display_init();
+    if (!g_core.drm) {
+      GST_ERROR ("drm_display_init fail");
+      pthread_mutex_unlock (&g_core_ref_lock);
+      return NULL;
+    }
+    drm_display_register_done_cb (g_core.drm, display_res_change_cb, NULL);
+    g_core.vsync_period_ns = DEFAULT_VSYNC_PERIOD_NS;
+  }
+  g_core.refcnt++;
+  drm = g_core.drm;
+  GST_INFO ("shared display engine ref %d", g_core.refcnt);
+  pthread_mutex_unlock (&g_core_ref_lock);
+  return drm;
+}
+
+static void display_core_put(void)
+{
+  pthread_mutex_lock (&g_core_ref_lock);
+  if (--g_core.refcnt > 0) {
+    pthread_mutex_unlock (&g_core_ref_lock);
+    return;
+  }
+
+  pthread_mutex_lock (&g_core.lock);
+  g_core.started = false;
+  pthread_cond_broadcast (&g_core.cond);
+  pthread_mutex_unlock (&g_core.lock);
+  if (g_core.disp_t) {
+    if (pthread_join (g_core.disp_t, NULL))
+      GST_ERROR ("join shared display thread %d", errno);
+    g_core.disp_t = 0;
+  }
+  drm_destroy_display (g_core.drm);
+  g_core.drm = NULL;
+  GST_INFO ("shared display engine released");
+  pthread_mutex_unlock (&g_core_ref_lock);
+}
+
+static int display_core_attach(struct video_disp *disp)
+{
+  int rc = 0;
+
+  pthread_mutex_lock (&g_core.lock);
+  g_core.disps = g_list_append (g_core.disps, disp);
+  if (!g_core.started) {
+    g_core.started = true;
+    rc = pthread_create (&g_core.disp_t, NULL, shared_display_thread_func, NULL);
+    if (rc) {
+      GST_ERROR ("create shared dispay thread fails\n");
+      g_core.started = false;
+      g_core.disp_t = 0;
+      g_core.disps = g_list_remove (g_core.disps, disp);
+    }
+  }
+  pthread_cond_broadcast (&g_core.cond);
+  pthread_mutex_unlock (&g_core.lock);
+  return rc;
+}
+
+static void display_core_detach(struct video_disp *disp)
+{
+  bool found;
+
+  pthread_mutex_lock (&g_core.lock);
+  found = g_list_find (g_core.disps, disp) != NULL;
+  if (found)
+    g_core.disps = g_list_remove (g_core.disps, disp);
+  /* thread may be releasing it after last frame */
+  while (g_list_find (g_core.finishing, disp))
+    pthread_cond_wait (&g_core.cond, &g_core.lock);
+  pthread_mutex_unlock (&g_core.lock);
+
+  /* sleeps and calls back into the sink, keep other planes running */
+  if (found)
+    display_vsync_finish (disp);
+}
+
+#ifndef DRM_FORMAT_MOD_VENDOR_AMLOGIC
+#define DRM_FORMAT_MOD_VENDOR_AMLOGIC 0x0a
+#endif
+
+static bool is_afbc_modifier(uint64_t mod)
+{
+  uint64_t vendor = mod >> 56;
+
+  /* ARM AFBC is type 0 of ARM vendor */
+  if (vendor == DRM_FORMAT_MOD_VENDOR_ARM)
+    return ((mod >> 52) & 0xf) == 0 && (mod & 0xfffffffffffffULL);
+  return vendor == DRM_FORMAT_MOD_VENDOR_AMLOGIC;
+}
+
+/* AFBC frames are allocated as YUYV with MESON_USE_VIDEO_AFBC, the
+ * plane must pair that format with an AFBC modifier in IN_FORMATS
+ */
+#define AFBC_FOURCC DRM_FORMAT_YUYV
+
+static bool modifier_has_format(const struct drm_format_modifier *mod,
+    uint32_t index)
+{
+  if (index < mod->offset || index >= mod->offset + 64)
+    return false;
+  return (mod->formats >> (index - mod->offset)) & 1;
+}
+
+static bool plane_supports_afbc(int fd, uint32_t plane_id)
+{
+  drmModeObjectPropertiesPtr props;
+  drmModePropertyBlobPtr blob = NULL;
+  bool ret = false;
+  uint32_t i;
+
+  props = drmModeObjectGetProperties (fd, plane_id, DRM_MODE_OBJECT_PLANE);
+  if (!props)
+    return false;
+
+  for (i = 0; i < props->count_props && !blob; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty (fd, props->props[i]);
+
+    if (!prop)
+      continue;
+    if (!strcmp (prop->name, "IN_FORMATS"))
+      blob = drmModeGetPropertyBlob (fd, props->prop_values[i]);
+    drmModeFreeProperty (prop);
+  }
+  drmModeFreeObjectProperties (props);
+
+  if (blob) {
+    struct drm_format_modifier_blob *hdr = blob->data;
+    uint32_t *formats = (uint32_t *)((char *)hdr + hdr->formats_offset);
+    struct drm_format_modifier *mods =
+      (struct drm_format_modifier *)((char *)hdr + hdr->modifiers_offset);
+    int fmt = -1;
+
+    for (i = 0; i < hdr->count_formats; i++)
+      if (formats[i] == AFBC_FOURCC)
+        fmt = i;
+
+    for (i = 0; fmt >= 0 && i < hdr->count_modifiers && !ret; i++) {
+      if (is_afbc_modifier (mods[i].modifier) &&
+          modifier_has_format (&mods[i], fmt)) {
+        GST_INFO ("plane %u afbc modifier %llx", plane_id,
+            (unsigned long long)mods[i].modifier);
+        ret = true;
+      }
+    }
+    drmModeFreePropertyBlob (blob);
+  }
+  return ret;
+}
+
+/* video planes take YUV only, OSD planes take RGB */
+static bool is_video_plane(drmModePlanePtr plane)
+{
+  uint32_t i;
+
+  for (i = 0; i < plane->count_formats; i++)
+    if (plane->formats[i] == DRM_FORMAT_ARGB8888 ||
+        plane->formats[i] == DRM_FORMAT_XRGB8888)
+      return false;
+  return plane->count_formats > 0;
+}
+
+/* probe VD1, or VD2 for pip, in plane id order */
+static bool probe_afbc_scanout(int fd, bool pip)
+{
+  drmModePlaneResPtr res;
+  bool ret = false;
+  int vd = 0;
+  uint32_t i;
+
+  drmSetClientCap (fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+  res = drmModeGetPlaneResources (fd);
+  if (!res)
+    return false;
+
+  for (i = 0; i < res->count_planes; i++) {
+    drmModePlanePtr plane = drmModeGetPlane (fd, res->planes[i]);
+    bool video;
+
+    if (!plane)
+      continue;
+    video = is_video_plane (plane);
+    drmModeFreePlane (plane);
+    if (!video)
+      continue;
+    if (vd++ == (pip ? 1 : 0)) {
+      ret = plane_supports_afbc (fd, res->planes[i]);
+      break;
+    }
+  }
+  drmModeFreePlaneResources (res);
+
+  GST_INFO ("afbc scanout on %s %s", pip ? "vd2" : "vd1",
+      ret ? "supported" : "not supported");
+  return ret;
+}
+
+void *display_engine_start(void* priv, bool pip, bool low_latency, bool shared)
 {
   struct video_disp *disp = NULL;
   struct drm_display *drm;
@@ -131,25 +451,39 @@ void *display_engine_start(void* priv, bool pip, bool low_latency)
     GST_ERROR ("recycle queue fail");
     goto error;
   }
-  drm = drm_display_init();
-  if (!drm) {
-    GST_ERROR ("drm_display_init fail");
-    goto error;
+  if (shared) {
+    drm = display_core_get();
+    if (!drm)
+      goto error;
+  } else {
+    drm = drm_display_init();
+    if (!drm) {
+      GST_ERROR ("drm_display_init fail");
+      goto error;
+    }
+    drm_display_register_done_cb (drm, display_res_change_cb, disp);
   }
 
-  drm_display_register_done_cb (drm, display_res_change_cb, disp);
   disp->drm = drm;
+  disp->shared = shared;
+  disp->afbc_scanout = probe_afbc_scanout (drm->drm_fd, pip);
   disp->priv = priv;
   disp->pause_pts = -1;
   disp->session = -1;
   disp->low_latency = low_latency;
+  disp->ll_policy = LL_POLICY_LATEST;
+  disp->ll_depth = 1;
+  disp->vsync_period_ns = DEFAULT_VSYNC_PERIOD_NS;
   pthread_mutex_init (&disp->avsync_lock, NULL);
   pthread_mutex_init (&disp->fq_lock, NULL);
 
-  disp->black_frame = create_black_frame (disp, 64, 64, pip);
+  disp->pip = pip;
   disp->black_frame_pending = BF_INVALID;
+  disp->plane_off_buf.flags = MESON_USE_VIDEO_PLANE |
+    (pip ? MESON_USE_VD2 : MESON_USE_VD1);
   disp->cur_frame = NULL;
-  g_rw_lock_init (&disp->scale_lock);
+  pthread_mutex_init (&disp->geo_lock, NULL);
+  display_vsync_reset (disp);
   /* avsync log level */
   log_set_level(AVS_LOG_INFO);
   return disp;
@@ -162,8 +496,8 @@ static void pause_pts_cb(uint32_t pts, void* priv)
 {
   struct video_disp * disp = priv;
 
-  if (pause_cb)
-    pause_cb (disp->priv, pts);
+  if (disp->pause_cb)
+    disp->pause_cb (disp->priv, pts);
 
   /* only trigger once */
   disp->pause_pts = -1;
@@ -173,8 +507,8 @@ static void underflow_check_cb(uint32_t pts, void* priv)
 {
   struct video_disp * disp = priv;
 
-  if (underflow_cb)
-    underflow_cb (disp->priv, pts);
+  if (disp->underflow_cb)
+    disp->underflow_cb (disp->priv, pts);
 }
 
 int display_start_avsync(void *handle, enum sync_mode mode, int id, int delay)
@@ -208,9 +542,10 @@ int display_start_avsync(void *handle, enum sync_mode mode, int id, int delay)
     }
 
     memset(&config, 0, sizeof(struct video_config));
-    config.delay = 2;
+    config.delay = AVSYNC_VSYNC_DELAY;
     config.extra_delay = delay;
     av_sync_video_config(disp->avsync, &config);
+    disp->extra_delay_ms = delay;
 
     if (disp->speed_pending) {
       disp->speed_pending = false;
@@ -238,12 +573,18 @@ int display_start_avsync(void *handle, enum sync_mode mode, int id, int delay)
     int rc;
     disp->disp_started = true;
     disp->last_frame = false;
+    display_vsync_reset (disp);
+    geometry_seed (disp);
 
-    rc = pthread_create(&disp->disp_t, NULL, display_thread_func, disp);
-    if (rc) {
-      GST_ERROR ("create dispay thread fails\n");
-      ret = -1;
+    if (disp->shared) {
+      rc = display_core_attach (disp);
+    } else {
+      rc = pthread_create(&disp->disp_t, NULL, display_thread_func, disp);
+      if (rc)
+        GST_ERROR ("create dispay thread fails\n");
     }
+    if (rc)
+      ret = -1;
 
     disp->recycle_started = true;
     rc = pthread_create(&disp->recycle_t, NULL, recycle_thread_func, disp);
@@ -273,9 +614,11 @@ void display_stop_avsync(void *handle)
       pop_frame = g_queue_pop_head (disp->fq);
       if (pop_frame) {
         f = pop_frame->private;
-        display_cb(disp->priv, f->pri_dec, true, true);
+        g_atomic_int_inc (&disp->frames_done);
+        disp->display_cb(disp->priv, f->pri_dec, true, true);
       }
     } while (pop_frame);
+    disp->ll_base_set = false;
     pthread_mutex_unlock (&disp->fq_lock);
     GST_INFO ("clean frame queue");
     return;
@@ -471,7 +814,9 @@ void display_engine_stop(void *handle)
   int rc;
 
   disp->disp_started = false;
-  if (disp->disp_t) {
+  if (disp->shared) {
+    display_core_detach (disp);
+  } else if (disp->disp_t) {
     rc = pthread_join (disp->disp_t, NULL);
     if (rc)
       GST_ERROR ("join display thread %d", errno);
@@ -505,184 +850,659 @@ void display_engine_stop(void *handle)
     disp->recycle_q = NULL;
   }
   destroy_black_frame (disp->black_frame);
-  drm_destroy_display (disp->drm);
-  g_rw_lock_clear (&disp->scale_lock);
+  if (disp->shared)
+    display_core_put ();
+  else
+    drm_destroy_display (disp->drm);
+  pthread_mutex_destroy (&disp->geo_lock);
   disp->drm = NULL;
   pthread_mutex_destroy (&disp->avsync_lock);
   free (disp);
 }
 
-/* Should only call during pause state
- * It will update the current frame position
+/* geo_lock held */
+static void geometry_seq_begin(struct video_disp *disp)
+{
+  __atomic_add_fetch (&disp->geo_seq, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static void geometry_write_begin(struct video_disp *disp)
+{
+  pthread_mutex_lock (&disp->geo_lock);
+  geometry_seq_begin (disp);
+}
+
+static void geometry_write_end(struct video_disp *disp)
+{
+  __atomic_add_fetch (&disp->geo_seq, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock (&disp->geo_lock);
+  g_atomic_int_set (&disp->geometry_pending, 1);
+}
+
+#define GEO_READ_RETRY 4
+
+/* snapshot of geometry for display thread, never blocks on writers.
+ * A writer preempted mid update must not stall the SCHED_FIFO thread,
+ * so retries are bounded. False when no new snapshot could be taken,
+ * geo is then the last good copy and caller keeps the current window
+ */
+static bool geometry_read(struct video_disp *disp, struct disp_geometry *geo)
+{
+  uint32_t seq;
+  int i;
+
+  for (i = 0; i < GEO_READ_RETRY; i++) {
+    seq = __atomic_load_n (&disp->geo_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    memcpy (geo, &disp->geo, sizeof(*geo));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (seq == __atomic_load_n (&disp->geo_seq, __ATOMIC_RELAXED)) {
+      disp->geo_last = *geo;
+      return true;
+    }
+  }
+
+  /* writers update under geo_lock, free lock means no write in progress */
+  if (!pthread_mutex_trylock (&disp->geo_lock)) {
+    *geo = disp->geo;
+    pthread_mutex_unlock (&disp->geo_lock);
+    disp->geo_last = *geo;
+    return true;
+  }
+
+  *geo = disp->geo_last;
+  /* pick up the new geometry on next vblank */
+  g_atomic_int_set (&disp->geometry_pending, 1);
+  return false;
+}
+
+/* before display thread runs, writers may have set a window already */
+static void geometry_seed(struct video_disp *disp)
+{
+  pthread_mutex_lock (&disp->geo_lock);
+  disp->geo_last = disp->geo;
+  disp->win_last = disp->geo.dst_win;
+  pthread_mutex_unlock (&disp->geo_lock);
+}
+
+/* Update geometry of the frame on screen, committed together with
+ * the frame on next vblank
  */
 void display_engine_refresh(void* handle, struct rect *dst, struct rect *src)
 {
   struct video_disp* disp = handle;
 
-  pthread_mutex_lock (&disp->avsync_lock);
-  if (disp->paused && disp->drm && disp->cur_frame) {
-    struct drm_buf* gem_buf;
+  if (!disp)
+    return;
+
+  geometry_write_begin (disp);
+  disp->geo.anim_active = false;
+  disp->geo.dst_win = *dst;
+  disp->geo.refresh_src = *src;
+  disp->geo.refresh_gen++;
+  geometry_write_end (disp);
+}
+
+static void update_vsync_period(gint *period_ns, drmVBlank *vbl,
+    uint32_t *last_seq, uint64_t *last_us)
+{
+  uint64_t now_us = (uint64_t)vbl->reply.tval_sec * 1000000 + vbl->reply.tval_usec;
 
-    gem_buf = disp->cur_frame->buf;
-    gem_buf->crtc_x = dst->x;
-    gem_buf->crtc_y = dst->y;
-    gem_buf->crtc_w = dst->w;
-    gem_buf->crtc_h = dst->h;
-    gem_buf->src_x = src->x;
-    gem_buf->src_y = src->y;
-    gem_buf->src_w = src->w;
-    gem_buf->src_h = src->h;
+  if (*last_us && vbl->reply.sequence > *last_seq && now_us > *last_us) {
+    uint64_t period = (now_us - *last_us) * 1000 / (vbl->reply.sequence - *last_seq);
+    gint old = g_atomic_int_get (period_ns);
 
-    disp->drm->set_plane(disp->drm, gem_buf);
+    /* ignore samples out of 20~250Hz, e.g. across mode switch */
+    if (period > 4000000 && period < 50000000)
+      g_atomic_int_set (period_ns, old + ((gint)period - old) / 8);
   }
-  pthread_mutex_unlock (&disp->avsync_lock);
+  *last_seq = vbl->reply.sequence;
+  *last_us = now_us;
 }
 
-static void * display_thread_func(void * arg)
+/* single writer: display thread */
+static void publish_position(struct video_disp *disp, struct drm_frame *f, uint64_t vsync_ns)
+{
+  __atomic_add_fetch (&disp->pos_seq, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  __atomic_store_n (&disp->pos_ts, f->timestamp, __ATOMIC_RELAXED);
+  __atomic_store_n (&disp->pos_vsync_ns, vsync_ns, __ATOMIC_RELAXED);
+  __atomic_store_n (&disp->pos_duration, f->duration, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&disp->pos_seq, 1, __ATOMIC_RELEASE);
+}
+
+/* timestamp of the frame on screen and the CLOCK_MONOTONIC time
+ * of the vblank it was flipped in, lock free
+ */
+int display_get_position(void *handle, uint64_t *timestamp,
+    uint64_t *vsync_ns, uint32_t *duration)
+{
+  struct video_disp *disp = handle;
+  uint32_t seq;
+  uint64_t ts, vsync;
+  uint32_t dur;
+
+  if (!disp)
+    return -1;
+
+  do {
+    seq = __atomic_load_n (&disp->pos_seq, __ATOMIC_ACQUIRE);
+    ts = __atomic_load_n (&disp->pos_ts, __ATOMIC_RELAXED);
+    vsync = __atomic_load_n (&disp->pos_vsync_ns, __ATOMIC_RELAXED);
+    dur = __atomic_load_n (&disp->pos_duration, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n (&disp->pos_seq, __ATOMIC_RELAXED));
+
+  if (!vsync)
+    return -1;
+
+  *timestamp = ts;
+  *vsync_ns = vsync;
+  *duration = dur;
+  return 0;
+}
+
+static void set_display_thread_sched(const char *name)
 {
-  struct video_disp *disp = arg;
-  struct drm_frame *f = NULL, *f_old = NULL;
-  bool first_frame_rendered = false;
-  drmVBlank vbl;
   struct sched_param schedParam;
-  int lastVsync_Cnt = -1;
+  int j;
+  cpu_set_t cpuset;
 
-  GST_DEBUG ("enter");
-  prctl (PR_SET_NAME, "aml_v_dis");
-  memset(&vbl, 0, sizeof(drmVBlank));
+  prctl (PR_SET_NAME, name);
 
   schedParam.sched_priority = sched_get_priority_max(SCHED_FIFO);
   if (pthread_setschedparam (pthread_self(), SCHED_FIFO, &schedParam))
     GST_WARNING ("fail to set display_thread_func priority");
 
-  {
-    int j;
-    cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (j = 0; j < 2; j++)
+    CPU_SET(j, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset))
+    GST_WARNING ("fail to set cpu affinity");
+}
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    CPU_ZERO(&cpuset);
-    for (j = 0; j < 2; j++)
-      CPU_SET(j, &cpuset);
-    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset))
-      GST_WARNING ("fail to set cpu affinity");
+static float ease(int easing, float t)
+{
+  switch (easing) {
+    case WIN_EASING_IN:
+      return t * t;
+    case WIN_EASING_OUT:
+      return 1.0f - (1.0f - t) * (1.0f - t);
+    case WIN_EASING_IN_OUT:
+      if (t < 0.5f)
+        return 2.0f * t * t;
+      return 1.0f - 2.0f * (1.0f - t) * (1.0f - t);
+    case WIN_EASING_LINEAR:
+    default:
+      return t;
   }
+}
+
+/* signed difference, window can shrink or move left/up */
+static uint32_t lerp(uint32_t from, uint32_t to, float k)
+{
+  int64_t v = (int64_t)from + (int64_t)(((int64_t)to - (int64_t)from) * k + 0.5f);
+
+  return v < 0 ? 0 : (uint32_t)v;
+}
+
+/* destination window at time now */
+static void animated_window(const struct disp_geometry *geo, uint64_t now,
+    struct rect *win)
+{
+  float k;
+
+  if (!geo->anim_active ||
+      now >= geo->anim_start_ns + geo->anim_duration_ns) {
+    *win = geo->dst_win;
+    return;
+  }
+
+  if (now <= geo->anim_start_ns)
+    k = 0;
+  else
+    k = (float)(now - geo->anim_start_ns) / geo->anim_duration_ns;
+  k = ease (geo->anim_easing, k);
+
+  win->x = lerp (geo->anim_from.x, geo->dst_win.x, k);
+  win->y = lerp (geo->anim_from.y, geo->dst_win.y, k);
+  win->w = lerp (geo->anim_from.w, geo->dst_win.w, k);
+  win->h = lerp (geo->anim_from.h, geo->dst_win.h, k);
+}
+
+static void ll_account_flip(struct video_disp *disp, struct drm_frame *f,
+    uint64_t vsync_ns)
+{
+  struct ll_stats *st = &disp->ll_stats;
+  uint64_t latency;
+
+  if (!f->arrival_ns || vsync_ns < f->arrival_ns)
+    return;
+  latency = vsync_ns - f->arrival_ns;
+
+  pthread_mutex_lock (&disp->fq_lock);
+  if (!st->shown || latency < st->latency_min_ns)
+    st->latency_min_ns = latency;
+  if (latency > st->latency_max_ns)
+    st->latency_max_ns = latency;
+  st->shown++;
+  disp->ll_latency_sum += latency;
+  st->latency_avg_ns = disp->ll_latency_sum / st->shown;
+  pthread_mutex_unlock (&disp->fq_lock);
+
+  if ((st->shown % 600) == 0)
+    GST_INFO ("low latency policy %d shown %llu dropped %llu latency %llu/%llu/%llu us",
+        disp->ll_policy, st->shown, st->dropped, st->latency_min_ns / 1000,
+        st->latency_avg_ns / 1000, st->latency_max_ns / 1000);
+}
+
+/* fq_lock held */
+static bool ll_frame_late(struct video_disp *disp, struct drm_frame *f, uint64_t now)
+{
+  int64_t due;
+
+  if (f->timestamp == (uint64_t)-1 || !disp->ll_base_set)
+    return false;
+  due = (int64_t)f->timestamp + disp->ll_base;
+  return (int64_t)now - due > (int64_t)disp->ll_deadline_ns;
+}
+
+/* fq_lock held, frame for this vsync by policy, the rest stay queued
+ * or are dropped
+ */
+static struct vframe *ll_pick_frame(struct video_disp *disp, uint64_t now)
+{
+  struct vframe *vf;
+  guint keep = 1;
+
+  if (disp->ll_policy == LL_POLICY_FIFO)
+    keep = disp->ll_depth;
+
+  while (g_queue_get_length (disp->fq) > keep) {
+    struct drm_frame *f;
+
+    vf = g_queue_peek_head (disp->fq);
+    f = vf->private;
+    /* never drop eos marker */
+    if (!f)
+      break;
+    if (disp->ll_policy == LL_POLICY_DEADLINE && !ll_frame_late (disp, f, now))
+      break;
+    g_queue_pop_head (disp->fq);
+    g_atomic_int_inc (&disp->frames_done);
+    disp->ll_stats.dropped++;
+    disp->display_cb(disp->priv, f->pri_dec, false, false);
+  }
+  return g_queue_pop_head (disp->fq);
+}
+
+/* called right after vblank */
+static void display_vsync_begin(struct video_disp *disp, uint64_t vsync_ns)
+{
+  struct disp_geometry geo;
+
+  disp->vsync_ns = vsync_ns;
+
+  /* commit an interpolated window on every vblank until animation ends,
+   * the final window included. Expiry is derived from time so the
+   * display thread never writes the shared geometry
+   */
+  geometry_read (disp, &geo);
+  if (geo.anim_active && disp->anim_done_start != geo.anim_start_ns) {
+    g_atomic_int_set (&disp->geometry_pending, 1);
+    if (vsync_ns >= geo.anim_start_ns + geo.anim_duration_ns)
+      disp->anim_done_start = geo.anim_start_ns;
+  }
+
+  /* frame posted last time is flipped on this vblank */
+  if (disp->f_flip) {
+    publish_position (disp, disp->f_flip, vsync_ns);
+    if (disp->low_latency)
+      ll_account_flip (disp, disp->f_flip, vsync_ns);
+    disp->f_flip = NULL;
+  }
+}
+
+/* geometry changed without new frame, update the plane of the frame
+ * on screen with both source and destination in one commit
+ */
+static void display_commit_geometry(struct video_disp *disp)
+{
+  struct drm_buf* gem_buf;
+  struct drm_frame *f = disp->cur_frame;
+  struct disp_geometry geo;
+  struct rect win;
+
+  if (!f || !g_atomic_int_compare_and_exchange (&disp->geometry_pending, 1, 0))
+    return;
+
+  gem_buf = f->buf;
+  /* writer busy, plane keeps its window until next vblank */
+  if (!geometry_read (disp, &geo))
+    return;
+  animated_window (&geo, disp->vsync_ns, &win);
+  disp->win_last = win;
+  gem_buf->crtc_x = win.x;
+  gem_buf->crtc_y = win.y;
+  gem_buf->crtc_w = win.w;
+  gem_buf->crtc_h = win.h;
+  /* source refreshed after this frame was posted */
+  if (geo.refresh_gen != disp->refresh_gen_used) {
+    gem_buf->src_x = geo.refresh_src.x;
+    gem_buf->src_y = geo.refresh_src.y;
+    gem_buf->src_w = geo.refresh_src.w;
+    gem_buf->src_h = geo.refresh_src.h;
+  }
+
+  GST_LOG ("geometry (%d,%d,%d,%d) on frame %u", gem_buf->crtc_x,
+      gem_buf->crtc_y, gem_buf->crtc_w, gem_buf->crtc_h, f->pts);
+  disp->drm->set_plane(disp->drm, gem_buf);
+}
+
+/* pick frame due on this vsync and post it */
+static int display_vsync_step(struct video_disp *disp)
+{
+  int rc;
+  struct drm_frame *f;
+  struct drm_buf* gem_buf;
+  struct vframe *sync_frame = NULL;
+  struct disp_geometry geo;
+  struct rect win;
+
+  if (!disp->low_latency) {
+    pthread_mutex_lock (&disp->avsync_lock);
+    if (disp->avsync)
+      sync_frame = av_sync_pop_frame(disp->avsync);
+    pthread_mutex_unlock (&disp->avsync_lock);
+  } else {
+    pthread_mutex_lock (&disp->fq_lock);
+    sync_frame = ll_pick_frame (disp, monotonic_ns ());
+    pthread_mutex_unlock (&disp->fq_lock);
+  }
+
+  /* handle black frame here so black frame is also inserted
+   * after all valid frames */
+  if (!sync_frame) {
+    disp->last_vsync_cnt++;
+    if (disp->black_frame_pending == BF_WAIT_RENDER) {
+      if (!disp->black_frame || (disp->black_frame_mode == BLACK_FRAME_PLANE_OFF &&
+            !g_atomic_int_get (&disp->plane_off_broken))) {
+        rc = drm_post_buf (disp->drm, &disp->plane_off_buf);
+        if (rc) {
+          GST_WARNING ("plane off fails errno %d, fall back to black buffer", errno);
+          g_atomic_int_set (&disp->plane_off_broken, 1);
+          if (disp->black_frame)
+            rc = drm_post_buf (disp->drm, disp->black_frame->buf);
+        }
+      } else {
+        rc = drm_post_buf (disp->drm, disp->black_frame->buf);
+      }
+      if (rc)
+        GST_ERROR ("show black frame fails errno %d", errno);
+      disp->f_flip = NULL;
+      disp->cur_frame = NULL;
+      disp->black_frame_pending = BF_INVALID;
+      disp->last_vsync_cnt = 0;
+      GST_INFO ("show black frame stat: 3");
+    } else {
+      display_commit_geometry (disp);
+    }
+    return DISP_STEP_IDLE;
+  }
+
+  if (!disp->first_frame_rendered)
+    log_info("vsink rendering first ts");
+
+  f = sync_frame->private;
+
+  if (!f) {
+    disp->last_frame = true;
+    return DISP_STEP_LAST;
+  }
+
+  if (f == disp->f_old) {
+    display_commit_geometry (disp);
+    return DISP_STEP_REPEAT;
+  }
+  g_atomic_int_inc (&disp->frames_done);
+
+  GST_LOG ("pop frame: %u", f->pts);
+  gem_buf = f->buf;
+
+  //set gem_buf window, pending geometry goes with this frame
+  g_atomic_int_set (&disp->geometry_pending, 0);
+  if (geometry_read (disp, &geo)) {
+    animated_window (&geo, disp->vsync_ns, &win);
+    disp->refresh_gen_used = geo.refresh_gen;
+    disp->win_last = win;
+  } else {
+    /* writer busy, same window as previous frame */
+    win = disp->win_last;
+  }
+  gem_buf->crtc_x = win.x;
+  gem_buf->crtc_y = win.y;
+  gem_buf->crtc_w = win.w;
+  gem_buf->crtc_h = win.h;
+
+  gem_buf->src_x = f->source_window.x;
+  gem_buf->src_y = f->source_window.y;
+  gem_buf->src_w = f->source_window.w;
+  gem_buf->src_h = f->source_window.h;
+
+  rc = drm_post_buf (disp->drm, gem_buf);
+  if (rc)
+    GST_ERROR ("drm_post_buf errno %d", errno);
+
+  /* when next two frame are posted, fence can be retrieved.
+   * So introduce two frames delay here
+   */
+  if (disp->f_old) {
+    rc = queue_item (disp->recycle_q, disp->f_old);
+    if (rc) {
+      GST_ERROR ("queue fail %d qlen %d", rc, queue_size(disp->recycle_q));
+      disp->display_cb(disp->priv, disp->f_old->pri_dec, true, false);
+    }
+  }
+
+  disp->f_old = f;
+  disp->f_flip = f;
+  disp->cur_frame = f;
+  disp->first_frame_rendered = true;
+  disp->last_vsync_cnt = 0;
+  return DISP_STEP_POSTED;
+}
+
+/* last pushed frame was flipped */
+static void display_check_eos(struct video_disp *disp)
+{
+  if (!g_atomic_int_get (&disp->eos_pending) || disp->f_flip)
+    return;
+  if (g_atomic_int_get (&disp->frames_done) != g_atomic_int_get (&disp->frames_pushed))
+    return;
+  if (!g_atomic_int_compare_and_exchange (&disp->eos_pending, 1, 0))
+    return;
+
+  GST_INFO ("last frame on screen, eos");
+  if (disp->eos_cb)
+    disp->eos_cb (disp->priv);
+}
+
+/* release the frame on screen when display stops */
+static void display_vsync_finish(struct video_disp *disp)
+{
+  if (disp->last_vsync_cnt != -1 && disp->last_vsync_cnt < 2) {
+    GST_LOG ("wait about 2 vsync for last frame");
+    usleep(40000);
+  }
+
+  if (disp->f_old)
+     disp->display_cb(disp->priv, disp->f_old->pri_dec, true, true);
+  disp->f_old = NULL;
+  disp->f_flip = NULL;
+  disp->cur_frame = NULL;
+}
+
+static void display_vsync_reset(struct video_disp *disp)
+{
+  disp->f_old = NULL;
+  disp->f_flip = NULL;
+  disp->first_frame_rendered = false;
+  disp->last_vsync_cnt = -1;
+}
+
+static void * display_thread_func(void * arg)
+{
+  struct video_disp *disp = arg;
+  drmVBlank vbl;
+  uint32_t last_vbl_seq = 0;
+  uint64_t last_vbl_us = 0;
+
+  GST_DEBUG ("enter");
+  set_display_thread_sched ("aml_v_dis");
+  memset(&vbl, 0, sizeof(drmVBlank));
 
   while (disp->disp_started) {
     int rc;
-    struct drm_buf* gem_buf;
-    struct vframe *sync_frame = NULL;
 
     vbl.request.type = DRM_VBLANK_RELATIVE;
     vbl.request.sequence = 1;
     vbl.request.signal = 0;
 
-    if (first_frame_rendered) {
+    if (disp->first_frame_rendered) {
       rc = drmWaitVBlank(disp->drm->drm_fd, &vbl);
       if (rc) {
         GST_ERROR ("drmWaitVBlank error %d\n", rc);
         return NULL;
       }
+      update_vsync_period (&disp->vsync_period_ns, &vbl, &last_vbl_seq, &last_vbl_us);
+      display_vsync_begin (disp, last_vbl_us * 1000);
     } else {
       usleep(1000);
+      disp->vsync_ns = monotonic_ns ();
     }
 
-    if (!disp->low_latency) {
-      pthread_mutex_lock (&disp->avsync_lock);
-      if (disp->avsync)
-        sync_frame = av_sync_pop_frame(disp->avsync);
-      pthread_mutex_unlock (&disp->avsync_lock);
-    } else {
-      struct vframe *pop_frame;
-      struct vframe *pre_frame = NULL;
-
-      /* get the latest frame */
-      pthread_mutex_lock (&disp->fq_lock);
-      do {
-        pop_frame = g_queue_pop_head (disp->fq);
-
-        /* release preframe */
-        if (pre_frame && pop_frame) {
-          struct drm_frame* f = pre_frame->private;
-          display_cb(disp->priv, f->pri_dec, true, false);
-        }
-        pre_frame = pop_frame;
+    rc = display_vsync_step (disp);
+    if (rc == DISP_STEP_LAST)
+      break;
+    display_check_eos (disp);
+    if (rc == DISP_STEP_IDLE)
+      usleep(1000);
+  }
 
-        if (pop_frame)
-          sync_frame = pop_frame;
-      } while (pop_frame);
-      pthread_mutex_unlock (&disp->fq_lock);
-    }
+  display_vsync_finish (disp);
 
-    /* handle black frame here so black frame is also inserted
-     * after all valid frames */
-    if (!sync_frame) {
-      lastVsync_Cnt++;
-      if (disp->black_frame_pending == BF_WAIT_RENDER) {
-        drm_post_buf (disp->drm, disp->black_frame->buf);
-        disp->black_frame_pending = BF_INVALID;
-        lastVsync_Cnt = 0;
-        GST_INFO ("show black frame stat: 3");
-      }
-      usleep(1000);
-      continue;
-    }
+  GST_INFO ("quit %s", __func__);
+  return NULL;
+}
 
-    if (!first_frame_rendered)
-      log_info("vsink rendering first ts");
+/* shared engine: one vsync thread posts frames of all planes */
+static void * shared_display_thread_func(void * arg)
+{
+  drmVBlank vbl;
+  uint32_t last_vbl_seq = 0;
+  uint64_t last_vbl_us = 0;
+  uint64_t vbl_ns = 0;
+  uint32_t vbl_err = 0;
 
-    f = sync_frame->private;
+  GST_DEBUG ("enter");
+  set_display_thread_sched ("aml_v_dis_s");
+  memset(&vbl, 0, sizeof(drmVBlank));
 
-    if (!f) {
-      disp->last_frame = true;
+  for (;;) {
+    int rc;
+    GList *l;
+    bool rendered = false, posted = false;
+
+    pthread_mutex_lock (&g_core.lock);
+    while (g_core.started && !g_core.disps)
+      pthread_cond_wait (&g_core.cond, &g_core.lock);
+    if (!g_core.started) {
+      pthread_mutex_unlock (&g_core.lock);
       break;
     }
+    for (l = g_core.disps; l; l = l->next) {
+      struct video_disp *disp = l->data;
+      if (disp->first_frame_rendered)
+        rendered = true;
+    }
+    pthread_mutex_unlock (&g_core.lock);
 
-    if (f != f_old) {
-      GST_LOG ("pop frame: %u", f->pts);
-      gem_buf = f->buf;
-
-      //set gem_buf window
-      g_rw_lock_reader_lock (&disp->scale_lock);
-      gem_buf->crtc_x = disp->dst_win.x;
-      gem_buf->crtc_y = disp->dst_win.y;
-      gem_buf->crtc_w = disp->dst_win.w;
-      gem_buf->crtc_h = disp->dst_win.h;
-      g_rw_lock_reader_unlock (&disp->scale_lock);
-
-      gem_buf->src_x = f->source_window.x;
-      gem_buf->src_y = f->source_window.y;
-      gem_buf->src_w = f->source_window.w;
-      gem_buf->src_h = f->source_window.h;
+    vbl.request.type = DRM_VBLANK_RELATIVE;
+    vbl.request.sequence = 1;
+    vbl.request.signal = 0;
 
-      rc = drm_post_buf (disp->drm, gem_buf);
-      if (rc)
-        GST_ERROR ("drm_post_buf errno %d", errno);
+    if (rendered) {
+      rc = drmWaitVBlank(g_core.drm->drm_fd, &vbl);
+      if (rc) {
+        /* other planes depend on this thread, pace by period and retry */
+        if (!vbl_err++)
+          GST_ERROR ("drmWaitVBlank error %d errno %d\n", rc, errno);
+        usleep (g_atomic_int_get (&g_core.vsync_period_ns) / 1000);
+        vbl_ns = monotonic_ns ();
+      } else {
+        if (vbl_err)
+          GST_WARNING ("drmWaitVBlank recovered after %u errors", vbl_err);
+        vbl_err = 0;
+        update_vsync_period (&g_core.vsync_period_ns, &vbl, &last_vbl_seq, &last_vbl_us);
+        vbl_ns = last_vbl_us * 1000;
+      }
+    } else {
+      usleep(1000);
+    }
 
-      /* when next two frame are posted, fence can be retrieved.
-       * So introduce two frames delay here
-       */
-      if (f_old) {
-        rc = queue_item (disp->recycle_q, f_old);
-        if (rc) {
-          GST_ERROR ("queue fail %d qlen %d", rc, queue_size(disp->recycle_q));
-          display_cb(disp->priv, f_old->pri_dec, true, false);
-        }
+    /* collect frames due for every plane and post them in this vblank */
+    pthread_mutex_lock (&g_core.lock);
+    l = g_core.disps;
+    while (l) {
+      struct video_disp *disp = l->data;
+      GList *next = l->next;
+
+      if (rendered) {
+        g_atomic_int_set (&disp->vsync_period_ns,
+            g_atomic_int_get (&g_core.vsync_period_ns));
+        display_vsync_begin (disp, vbl_ns);
+      } else {
+        disp->vsync_ns = monotonic_ns ();
       }
 
-      f_old = f;
-      disp->cur_frame = f;
-      first_frame_rendered = true;
-      lastVsync_Cnt = 0;
+      rc = display_vsync_step (disp);
+      if (rc == DISP_STEP_POSTED) {
+        posted = true;
+      } else if (rc == DISP_STEP_LAST) {
+        g_core.disps = g_list_remove_link (g_core.disps, l);
+        g_core.finishing = g_list_concat (g_core.finishing, l);
+      }
+      if (rc != DISP_STEP_LAST)
+        display_check_eos (disp);
+      l = next;
+    }
+    pthread_mutex_unlock (&g_core.lock);
+
+    /* release last frames without holding up the other planes */
+    if (g_core.finishing) {
+      for (l = g_core.finishing; l; l = l->next)
+        display_vsync_finish (l->data);
+      pthread_mutex_lock (&g_core.lock);
+      g_list_free (g_core.finishing);
+      g_core.finishing = NULL;
+      pthread_cond_broadcast (&g_core.cond);
+      pthread_mutex_unlock (&g_core.lock);
     }
-  }
 
-  if (lastVsync_Cnt != -1 && lastVsync_Cnt < 2) {
-    GST_LOG ("wait about 2 vsync for last frame");
-    usleep(40000);
+    if (!posted)
+      usleep(1000);
   }
 
-  if (f_old)
-     display_cb(disp->priv, f_old->pri_dec, true, true);
-
   GST_INFO ("quit %s", __func__);
   return NULL;
 }
@@ -714,11 +1534,11 @@ static void * recycle_thread_func(void * arg)
     rc = drm_waitvideoFence(gem_buf->fd[0]);
     if (rc <= 0)
       GST_WARNING ("wait fence error %d", rc);
-    display_cb(disp->priv, f->pri_dec, true, false);
+    disp->display_cb(disp->priv, f->pri_dec, true, false);
   }
 
   while (!dqueue_item(disp->recycle_q, (void **)&f)) {
-    display_cb(disp->priv, f->pri_dec, false, true);
+    disp->display_cb(disp->priv, f->pri_dec, false, true);
   }
 
   GST_INFO ("quit %s", __func__);
@@ -736,18 +1556,23 @@ static void sync_frame_free(struct vframe * sync_frame)
   }
 
   if (drm_f) {
-    display_cb(disp->priv, drm_f->pri_dec, false, false);
+    g_atomic_int_inc (&disp->frames_done);
+    disp->display_cb(disp->priv, drm_f->pri_dec, false, false);
   } else {
     disp->last_frame = true;
     GST_INFO ("last frame detected");
   }
 }
 
-int display_engine_show(void* handle, struct drm_frame* frame, struct rect* src_window)
+/* frames dequeued in one decoder wakeup, sharing one source window.
+ * Returns number of leading frames accepted
+ */
+int display_engine_show_batch(void *handle, struct drm_frame **frames,
+    int num, struct rect *src_window)
 {
   struct video_disp *disp = handle;
-  int rc;
-  struct vframe* sync_frame = &frame->sync_frame;
+  uint64_t now;
+  int i;
 
   if (!disp || (!disp->avsync && !disp->low_latency) || (!disp->fq && disp->low_latency)) {
     GST_ERROR ("avsync not started");
@@ -758,40 +1583,108 @@ int display_engine_show(void* handle, struct drm_frame* frame, struct rect* src_
     return -1;
   }
 
-  sync_frame->private = frame;
-  sync_frame->pts = frame->pts;
-  sync_frame->duration = frame->duration;
-  sync_frame->free = sync_frame_free;
-  frame->source_window = *src_window;
+  for (i = 0; i < num; i++) {
+    struct drm_frame *frame = frames[i];
+    struct vframe* sync_frame = &frame->sync_frame;
+
+    sync_frame->private = frame;
+    sync_frame->pts = frame->pts;
+    sync_frame->duration = frame->duration;
+    sync_frame->free = sync_frame_free;
+    frame->source_window = *src_window;
+  }
 
   if (!disp->low_latency) {
-    rc = av_sync_push_frame(disp->avsync, sync_frame);
-    if (!rc)
+    for (i = 0; i < num; i++) {
+      struct vframe* sync_frame = &frames[i]->sync_frame;
+
+      g_atomic_int_inc (&disp->frames_pushed);
+      if (av_sync_push_frame(disp->avsync, sync_frame)) {
+        g_atomic_int_add (&disp->frames_pushed, -1);
+        break;
+      }
       GST_LOG ("push frame: %u", sync_frame->pts);
-  } else {
-    pthread_mutex_lock (&disp->fq_lock);
-    g_queue_push_tail(disp->fq, sync_frame);
-    pthread_mutex_unlock (&disp->fq_lock);
+    }
+    return i;
   }
 
+  /* one lock and one clock read for the batch */
+  now = monotonic_ns ();
+  g_atomic_int_add (&disp->frames_pushed, num);
+  pthread_mutex_lock (&disp->fq_lock);
+  for (i = 0; i < num; i++) {
+    struct drm_frame *frame = frames[i];
+
+    frame->arrival_ns = now;
+    if (frame->timestamp != (uint64_t)-1) {
+      int64_t base = (int64_t)frame->arrival_ns - (int64_t)frame->timestamp;
+
+      if (!disp->ll_base_set || base < disp->ll_base) {
+        disp->ll_base = base;
+        disp->ll_base_set = true;
+      }
+    }
+    g_queue_push_tail(disp->fq, &frame->sync_frame);
+  }
+  pthread_mutex_unlock (&disp->fq_lock);
+  return num;
+}
+
+int display_engine_show(void* handle, struct drm_frame* frame, struct rect* src_window)
+{
+  return display_engine_show_batch (handle, &frame, 1, src_window) == 1 ? 0 : -1;
+}
+
+int display_engine_register_cb(void *handle, displayed_cb_func cb)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return -1;
+  disp->display_cb = cb;
   return 0;
 }
 
-int display_engine_register_cb(displayed_cb_func cb)
+int pause_pts_register_cb(void *handle, pause_cb_func cb)
 {
-  display_cb = cb;
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return -1;
+  disp->pause_cb = cb;
   return 0;
 }
 
-int pause_pts_register_cb(pause_cb_func cb)
+int display_eos_register_cb(void *handle, eos_cb_func cb)
 {
-  pause_cb = cb;
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return -1;
+  disp->eos_cb = cb;
   return 0;
 }
 
-int display_underflow_register_cb(underflow_cb_func cb)
+/* called after the decoder drained, or with false on flush */
+void display_engine_set_eos(void *handle, bool eos)
 {
-  underflow_cb = cb;
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return;
+  g_atomic_int_set (&disp->eos_pending, eos ? 1 : 0);
+  GST_INFO ("eos pending %d pushed %d done %d", eos,
+      g_atomic_int_get (&disp->frames_pushed),
+      g_atomic_int_get (&disp->frames_done));
+}
+
+int display_underflow_register_cb(void *handle, underflow_cb_func cb)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return -1;
+  disp->underflow_cb = cb;
   return 0;
 }
 int display_set_checkunderflow(void *handle, bool underflow_check)
@@ -828,17 +1721,50 @@ int display_set_pause_pts(void *handle, uint32_t pause_pts)
   return 0;
 }
 
+void display_set_black_frame_mode(void *handle, int mode)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return;
+
+  pthread_mutex_lock (&disp->avsync_lock);
+  disp->black_frame_mode = mode;
+  pthread_mutex_unlock (&disp->avsync_lock);
+}
+
 int display_show_black_frame(void * handle)
 {
   struct video_disp *disp = handle;
+  struct drm_frame *black = NULL;
+  bool need_buf;
 
   pthread_mutex_lock (&disp->avsync_lock);
+  need_buf = !disp->black_frame &&
+    (disp->black_frame_mode == BLACK_FRAME_BUFFER ||
+     g_atomic_int_get (&disp->plane_off_broken));
+  pthread_mutex_unlock (&disp->avsync_lock);
+
+  /* gem alloc can block, keep it off the lock the display thread takes */
+  if (need_buf) {
+    black = create_black_frame (disp, 64, 64, disp->pip);
+    if (!black)
+      GST_WARNING ("black frame alloc fail, turn plane off instead");
+  }
+
+  pthread_mutex_lock (&disp->avsync_lock);
+  if (black && !disp->black_frame) {
+    disp->black_frame = black;
+    black = NULL;
+  }
   if (disp->avsync)
     disp->black_frame_pending = BF_WAIT_AV_SYNC;
   else
     disp->black_frame_pending = BF_WAIT_RENDER;
   GST_INFO ("show black frame stat: %d", disp->black_frame_pending);
   pthread_mutex_unlock (&disp->avsync_lock);
+  if (black)
+    destroy_black_frame (black);
 }
 
 int display_set_speed(void *handle, float speed)
@@ -861,15 +1787,95 @@ int display_set_speed(void *handle, float speed)
   return 0;
 }
 
+/* move destination window to target in duration_ms, interpolated
+ * by display thread on every vblank from the window currently shown
+ */
+void display_engine_animate_dst_rect(void *handle, struct rect *window,
+    uint32_t duration_ms, int easing)
+{
+  struct video_disp *disp = handle;
+  uint64_t now;
+
+  if (!disp)
+    return;
+
+  if (!duration_ms) {
+    display_engine_set_dst_rect (handle, window);
+    return;
+  }
+
+  geometry_write_begin (disp);
+  now = monotonic_ns ();
+  animated_window (&disp->geo, now, &disp->geo.anim_from);
+  disp->geo.dst_win = *window;
+  disp->geo.anim_start_ns = now;
+  disp->geo.anim_duration_ns = (uint64_t)duration_ms * 1000000;
+  disp->geo.anim_easing = easing;
+  disp->geo.anim_active = true;
+  geometry_write_end (disp);
+  GST_DEBUG ("animate to (%d,%d,%d,%d) in %u ms easing %d", window->x,
+      window->y, window->w, window->h, duration_ms, easing);
+}
+
+void display_set_ll_policy(void *handle, int policy, uint32_t param)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return;
+
+  pthread_mutex_lock (&disp->fq_lock);
+  disp->ll_policy = policy;
+  disp->ll_depth = 1;
+  disp->ll_deadline_ns = 0;
+  if (policy == LL_POLICY_FIFO)
+    disp->ll_depth = param ? param : 1;
+  else if (policy == LL_POLICY_DEADLINE)
+    disp->ll_deadline_ns = (uint64_t)param * 1000000;
+  memset (&disp->ll_stats, 0, sizeof(disp->ll_stats));
+  disp->ll_latency_sum = 0;
+  pthread_mutex_unlock (&disp->fq_lock);
+  GST_INFO ("low latency policy %d param %u", policy, param);
+}
+
+int display_get_ll_stats(void *handle, struct ll_stats *stats)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp || !disp->low_latency)
+    return -1;
+
+  pthread_mutex_lock (&disp->fq_lock);
+  *stats = disp->ll_stats;
+  pthread_mutex_unlock (&disp->fq_lock);
+  return 0;
+}
+
+bool display_afbc_supported(void *handle)
+{
+  struct video_disp *disp = handle;
+
+  return disp && disp->afbc_scanout;
+}
+
 void display_engine_set_dst_rect(void *handle, struct rect *window)
 {
   struct video_disp *disp = handle;
 
-  if (memcmp(&disp->dst_win, window, sizeof(*window))) {
-    g_rw_lock_writer_lock (&disp->scale_lock);
-    memcpy (&disp->dst_win, window, sizeof(*window));
-    g_rw_lock_writer_unlock (&disp->scale_lock);
+  if (!disp)
+    return;
+
+  /* writers are serialized, compare under geo_lock */
+  pthread_mutex_lock (&disp->geo_lock);
+  if (!disp->geo.anim_active &&
+      !memcmp(&disp->geo.dst_win, window, sizeof(*window))) {
+    pthread_mutex_unlock (&disp->geo_lock);
+    return;
   }
+  geometry_seq_begin (disp);
+  disp->geo.anim_active = false;
+  memcpy (&disp->geo.dst_win, window, sizeof(*window));
+  geometry_write_end (disp);
 }
 
 void display_set_video_delay(void *handle, int delay_ms)
@@ -881,11 +1887,45 @@ void display_set_video_delay(void *handle, int delay_ms)
     return;
 
   pthread_mutex_lock (&disp->avsync_lock);
+  disp->extra_delay_ms = delay_ms;
   if (disp->avsync) {
     memset(&config, 0, sizeof(struct video_config));
-    config.delay = 2;
+    config.delay = AVSYNC_VSYNC_DELAY;
     config.extra_delay = delay_ms;
     av_sync_video_config(disp->avsync, &config);
   }
   pthread_mutex_unlock (&disp->avsync_lock);
 }
+
+/* latency added by the display path, in ns
+ * min: avsync hold + scan out, max: plus frames held for fence
+ */
+int display_get_latency(void *handle, uint64_t *min_ns, uint64_t *max_ns)
+{
+  struct video_disp *disp = handle;
+  uint64_t period;
+
+  if (!disp || !min_ns || !max_ns)
+    return -1;
+
+  period = g_atomic_int_get (&disp->vsync_period_ns);
+  if (disp->low_latency) {
+    /* posted on next vblank, scanned out on the one after */
+    *min_ns = period;
+    *max_ns = 2 * period;
+  } else {
+    *min_ns = (AVSYNC_VSYNC_DELAY + 1) * period +
+      (uint64_t)disp->extra_delay_ms * 1000000;
+    *max_ns = *min_ns + POST_DELAY_FRAMES * period;
+  }
+  return 0;
+}
+
+uint32_t display_get_vsync_period(void *handle)
+{
+  struct video_disp *disp = handle;
+
+  if (!disp)
+    return DEFAULT_VSYNC_PERIOD_NS;
+  return g_atomic_int_get (&disp->vsync_period_ns);
+}
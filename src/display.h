@@ -30,6 +30,34 @@ enum frame_format {
   FRAME_FMT_AFBC,
 };
 
+enum win_easing {
+  WIN_EASING_LINEAR,
+  WIN_EASING_IN,
+  WIN_EASING_OUT,
+  WIN_EASING_IN_OUT,
+};
+
+/* frame selection of low latency mode */
+enum ll_policy {
+  LL_POLICY_LATEST,   /* newest frame only, drop the rest */
+  LL_POLICY_FIFO,     /* every frame, queue bounded to depth */
+  LL_POLICY_DEADLINE, /* drop frames later than deadline */
+};
+
+struct ll_stats {
+  uint64_t shown;
+  uint64_t dropped;
+  /* decoder output to vblank of flip */
+  uint64_t latency_min_ns;
+  uint64_t latency_max_ns;
+  uint64_t latency_avg_ns;
+};
+
+enum black_frame_mode {
+  BLACK_FRAME_BUFFER,    /* post a black NV12 frame */
+  BLACK_FRAME_PLANE_OFF, /* commit null framebuffer, no allocation */
+};
+
 typedef struct drm_frame drm_frame;
 
 typedef int (*drm_frame_destroy)(drm_frame*);
@@ -52,6 +80,8 @@ struct drm_frame {
   uint32_t height;
 
   uint32_t pts;
+  uint64_t timestamp; /* ns, for position report */
+  uint64_t arrival_ns; /* CLOCK_MONOTONIC when queued to display */
   void* pri_sync;
   uint32_t duration;
   void* pri_dec;
@@ -63,12 +93,13 @@ struct drm_frame {
 typedef int (*displayed_cb_func)(void* priv, void* handle, bool displayed, bool recycled);
 typedef int (*pause_cb_func)(void* priv, uint32_t pts);
 typedef int (*underflow_cb_func)(void* priv, uint32_t pts);
+typedef int (*eos_cb_func)(void* priv);
 
-void *display_engine_start(void* priv, bool pip, bool low_latency);
+void *display_engine_start(void* priv, bool pip, bool low_latency, bool shared);
 void display_engine_stop(void * handle);
-int display_engine_register_cb(displayed_cb_func cb);
-int pause_pts_register_cb(pause_cb_func cb);
-int display_underflow_register_cb(underflow_cb_func cb);
+int display_engine_register_cb(void *handle, displayed_cb_func cb);
+int pause_pts_register_cb(void *handle, pause_cb_func cb);
+int display_underflow_register_cb(void *handle, underflow_cb_func cb);
 
 struct drm_frame* display_create_buffer(void *handle,
         unsigned int width, unsigned int height,
@@ -76,10 +107,17 @@ struct drm_frame* display_create_buffer(void *handle,
         bool secure, bool pip);
 int display_get_buffer_fds(struct drm_frame *drm_f, int *fd, int cnt);
 int display_engine_show(void *handle, struct drm_frame* frame, struct rect *src_window);
+int display_engine_show_batch(void *handle, struct drm_frame **frames,
+    int num, struct rect *src_window);
 void display_engine_set_dst_rect(void *handle, struct rect *window);
+void display_engine_animate_dst_rect(void *handle, struct rect *window,
+    uint32_t duration_ms, int easing);
 int display_start_avsync(void *handle, enum sync_mode mode, int id, int delay);
 void display_stop_avsync(void *handle);
 int display_show_black_frame(void * handle);
+int display_eos_register_cb(void *handle, eos_cb_func cb);
+void display_engine_set_eos(void *handle, bool eos);
+void display_set_black_frame_mode(void *handle, int mode);
 
 int display_set_pause(void *handle, bool pause);
 int display_set_pause_pts(void *handle, uint32_t pause_pts);
@@ -87,4 +125,13 @@ int display_set_speed(void *handle, float speed);
 int display_set_checkunderflow(void *handle, bool underflow_check);
 void display_engine_refresh(void* handle, struct rect *dst, struct rect *src);
 void display_set_video_delay(void* handle, int delay_ms);
+int display_get_latency(void *handle, uint64_t *min_ns, uint64_t *max_ns);
+uint32_t display_get_vsync_period(void *handle);
+int display_get_position(void *handle, uint64_t *timestamp,
+    uint64_t *vsync_ns, uint32_t *duration);
+/* video plane can scan out AFBC compressed frames */
+bool display_afbc_supported(void *handle);
+/* param is queue depth for FIFO and ms for DEADLINE */
+void display_set_ll_policy(void *handle, int policy, uint32_t param);
+int display_get_ll_stats(void *handle, struct ll_stats *stats);
 #endif
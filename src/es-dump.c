@@ -0,0 +1,289 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <linux/videodev2.h>
+#include <gst/gst.h>
+
+#include "es-dump.h"
+
+GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
+#define GST_CAT_DEFAULT gst_aml_vsink_debug
+
+#define RING_SIZE (16 << 20)
+/* marks unused tail of ring, next record starts at 0 */
+#define REC_WRAP 0xffffffff
+#define REC_ALIGN(x) (((x) + 7) & ~(size_t)7)
+/* IVF time base 1/90000 */
+#define IVF_RATE 90000
+
+struct rec_hdr {
+  uint32_t size;
+  uint32_t flags;
+  uint64_t pts_ns;
+};
+
+/* single producer (streaming thread), single consumer (writer) */
+struct es_dump {
+  uint8_t *ring;
+  /* byte counters, only grow */
+  uint64_t head;
+  uint64_t tail;
+  int quit;
+  guint dropped;
+  GThread *thread;
+
+  FILE *es;
+  FILE *idx;
+  bool ivf;
+  uint32_t fourcc;
+  int width;
+  int height;
+  uint64_t frames;
+  uint64_t offset;
+};
+
+static gint session;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  put_le16 (p, v & 0xffff);
+  put_le16 (p + 2, v >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+  put_le32 (p, v & 0xffffffff);
+  put_le32 (p + 4, v >> 32);
+}
+
+static void write_ivf_header(struct es_dump *d, uint32_t frames)
+{
+  uint8_t h[32] = { 'D', 'K', 'I', 'F' };
+
+  put_le16 (h + 4, 0);
+  put_le16 (h + 6, sizeof(h));
+  put_le32 (h + 8, d->fourcc);
+  put_le16 (h + 12, d->width > 0 ? d->width : 0);
+  put_le16 (h + 14, d->height > 0 ? d->height : 0);
+  put_le32 (h + 16, IVF_RATE);
+  put_le32 (h + 20, 1);
+  put_le32 (h + 24, frames);
+  fwrite (h, 1, sizeof(h), d->es);
+}
+
+static void write_record(struct es_dump *d, const struct rec_hdr *h,
+    const uint8_t *data)
+{
+  if (d->ivf) {
+    uint8_t fh[12];
+
+    /* av1C/vpcC is not part of IVF */
+    if (h->flags & ES_DUMP_CODEC_DATA)
+      return;
+    put_le32 (fh, h->size);
+    put_le64 (fh + 4, gst_util_uint64_scale (h->pts_ns, IVF_RATE, GST_SECOND));
+    fwrite (fh, 1, sizeof(fh), d->es);
+    d->offset += sizeof(fh);
+  }
+  fwrite (data, 1, h->size, d->es);
+
+  if (!(h->flags & ES_DUMP_CODEC_DATA)) {
+    fprintf (d->idx, "%llu %llu %u %llu %d\n",
+        (unsigned long long)d->frames, (unsigned long long)d->offset,
+        h->size, (unsigned long long)h->pts_ns, !!(h->flags & ES_DUMP_KEY));
+    d->frames++;
+  }
+  d->offset += h->size;
+}
+
+static gpointer writer_thread(gpointer data)
+{
+  struct es_dump *d = data;
+
+  prctl (PR_SET_NAME, "aml_es_dump");
+  for (;;) {
+    uint64_t tail = __atomic_load_n (&d->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n (&d->head, __ATOMIC_ACQUIRE);
+    size_t pos, contig;
+    struct rec_hdr h;
+
+    if (tail == head) {
+      if (__atomic_load_n (&d->quit, __ATOMIC_ACQUIRE)) {
+        /* producer is gone, recheck once */
+        if (tail == __atomic_load_n (&d->head, __ATOMIC_ACQUIRE))
+          break;
+        continue;
+      }
+      g_usleep (5000);
+      continue;
+    }
+
+    pos = tail % RING_SIZE;
+    contig = RING_SIZE - pos;
+    memcpy (&h.size, d->ring + pos, sizeof(h.size));
+    if (h.size == REC_WRAP) {
+      __atomic_store_n (&d->tail, tail + contig, __ATOMIC_RELEASE);
+      continue;
+    }
+    memcpy (&h, d->ring + pos, sizeof(h));
+    write_record (d, &h, d->ring + pos + sizeof(h));
+    __atomic_store_n (&d->tail, tail + REC_ALIGN (sizeof(h) + h.size),
+        __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+struct es_dump *es_dump_open(const char *location, uint32_t v4l2_fmt,
+    int width, int height)
+{
+  struct es_dump *d;
+  const char *ext;
+  gchar *base, *path;
+  int n;
+
+  d = g_new0 (struct es_dump, 1);
+  d->width = width;
+  d->height = height;
+  switch (v4l2_fmt) {
+  case V4L2_PIX_FMT_VP9:
+    d->ivf = true;
+    d->fourcc = GST_MAKE_FOURCC ('V', 'P', '9', '0');
+    ext = "ivf";
+    break;
+  case V4L2_PIX_FMT_AV1:
+    d->ivf = true;
+    d->fourcc = GST_MAKE_FOURCC ('A', 'V', '0', '1');
+    ext = "ivf";
+    break;
+  case V4L2_PIX_FMT_H264:
+    ext = "h264";
+    break;
+  case V4L2_PIX_FMT_HEVC:
+    ext = "h265";
+    break;
+  default:
+    ext = "es";
+    break;
+  }
+
+  n = g_atomic_int_add (&session, 1);
+  base = g_strdup_printf ("%s-%d", location, n);
+  path = g_strdup_printf ("%s.%s", base, ext);
+  d->es = fopen (path, "wb");
+  g_free (path);
+  path = g_strdup_printf ("%s.idx", base);
+  d->idx = fopen (path, "w");
+  g_free (path);
+  if (!d->es || !d->idx) {
+    GST_ERROR ("open dump %s fail", base);
+    g_free (base);
+    goto error;
+  }
+  fprintf (d->idx, "# frame offset size pts_ns key\n");
+
+  d->ring = g_try_malloc (RING_SIZE);
+  if (!d->ring) {
+    GST_ERROR ("no memory for dump ring");
+    g_free (base);
+    goto error;
+  }
+  if (d->ivf) {
+    write_ivf_header (d, 0);
+    d->offset = 32;
+  }
+
+  d->thread = g_thread_try_new ("aml_es_dump", writer_thread, d, NULL);
+  if (!d->thread) {
+    GST_ERROR ("create dump thread fail");
+    g_free (base);
+    goto error;
+  }
+  GST_WARNING ("dump es to %s", base);
+  g_free (base);
+  return d;
+
+error:
+  if (d->es)
+    fclose (d->es);
+  if (d->idx)
+    fclose (d->idx);
+  g_free (d->ring);
+  g_free (d);
+  return NULL;
+}
+
+bool es_dump_push(struct es_dump *d, const uint8_t *data, size_t size,
+    uint64_t pts_ns, uint32_t flags)
+{
+  uint64_t head = __atomic_load_n (&d->head, __ATOMIC_RELAXED);
+  uint64_t tail = __atomic_load_n (&d->tail, __ATOMIC_ACQUIRE);
+  size_t need = REC_ALIGN (sizeof(struct rec_hdr) + size);
+  size_t pos = head % RING_SIZE;
+  size_t contig = RING_SIZE - pos;
+  size_t total = contig < need ? contig + need : need;
+  struct rec_hdr h = {
+    .size = size,
+    .flags = flags,
+    .pts_ns = pts_ns,
+  };
+
+  if (need > RING_SIZE / 2 || head - tail + total > RING_SIZE) {
+    g_atomic_int_inc (&d->dropped);
+    return false;
+  }
+
+  if (contig < need) {
+    uint32_t wrap = REC_WRAP;
+
+    memcpy (d->ring + pos, &wrap, sizeof(wrap));
+    head += contig;
+    pos = 0;
+  }
+  memcpy (d->ring + pos, &h, sizeof(h));
+  memcpy (d->ring + pos + sizeof(h), data, size);
+  __atomic_store_n (&d->head, head + need, __ATOMIC_RELEASE);
+  return true;
+}
+
+void es_dump_close(struct es_dump *d)
+{
+  if (!d)
+    return;
+
+  __atomic_store_n (&d->quit, 1, __ATOMIC_RELEASE);
+  g_thread_join (d->thread);
+
+  if (d->ivf && !fseek (d->es, 0, SEEK_SET))
+    write_ivf_header (d, d->frames);
+  GST_WARNING ("es dump done, %llu frames %llu bytes, %u dropped",
+      (unsigned long long)d->frames, (unsigned long long)d->offset,
+      g_atomic_int_get (&d->dropped));
+  fclose (d->es);
+  fclose (d->idx);
+  g_free (d->ring);
+  g_free (d);
+}
@@ -0,0 +1,43 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef _ES_DUMP_H_
+#define _ES_DUMP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* record flags */
+#define ES_DUMP_KEY        (1 << 0)
+/* codec data ahead of first frame, not indexed */
+#define ES_DUMP_CODEC_DATA (1 << 1)
+
+struct es_dump;
+
+/* one session writes <location>-<n>.<ext> and <location>-<n>.idx,
+ * VP9/AV1 as IVF, others as received (Annex-B for H.264/H.265)
+ */
+struct es_dump *es_dump_open(const char *location, uint32_t v4l2_fmt,
+    int width, int height);
+/* never blocks, data is dropped when writer falls behind */
+bool es_dump_push(struct es_dump *d, const uint8_t *data, size_t size,
+    uint64_t pts_ns, uint32_t flags);
+/* drain ring and close files */
+void es_dump_close(struct es_dump *d);
+#endif
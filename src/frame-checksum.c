@@ -0,0 +1,328 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <linux/dma-buf.h>
+#include <gst/gst.h>
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#elif defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "frame-checksum.h"
+
+GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
+#define GST_CAT_DEFAULT gst_aml_vsink_debug
+
+struct csum_job {
+  void *handle;
+  struct csum_plane plane[2];
+  int w;
+  int h;
+  uint64_t pts;
+};
+
+struct frame_checksum {
+  GThread *thread;
+  GAsyncQueue *queue;
+  FILE *out;
+  csum_result_cb result_cb;
+  csum_done_cb done_cb;
+  void *priv;
+
+  /* submitted but not done */
+  GMutex lock;
+  GCond idle;
+  int pending;
+};
+
+/* quit marker */
+static struct csum_job quit_job;
+
+static uint32_t crc_table[8][256];
+
+static void init_table(void)
+{
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    uint32_t c = i;
+
+    for (j = 0; j < 8; j++)
+      c = (c >> 1) ^ (0x82f63b78 & (0 - (c & 1)));
+    crc_table[0][i] = c;
+  }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^
+        crc_table[0][crc_table[j - 1][i] & 0xff];
+}
+
+/* slicing by 8, crc is pre-inverted */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+  for (; len >= 8; len -= 8, p += 8) {
+    uint32_t lo, hi;
+
+    memcpy (&lo, p, 4);
+    memcpy (&hi, p + 4, 4);
+    lo ^= crc;
+    crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+      crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+      crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+      crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+  }
+  for (; len; len--)
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+/* CRC instructions are optional in armv8.0 and need SSE4.2 on x86,
+ * built for the baseline ISA and picked at runtime
+ */
+#if defined(__aarch64__)
+#define HAVE_CRC_HW 1
+__attribute__((target("+crc")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t v;
+
+    memcpy (&v, p, 8);
+    crc = __crc32cd (crc, v);
+  }
+  for (; len; len--)
+    crc = __crc32cb (crc, *p++);
+  return crc;
+}
+
+static bool crc_hw_supported(void)
+{
+  return getauxval (AT_HWCAP) & HWCAP_CRC32;
+}
+#elif defined(__x86_64__)
+#define HAVE_CRC_HW 1
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+  uint64_t c = crc;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t v;
+
+    memcpy (&v, p, 8);
+    c = _mm_crc32_u64 (c, v);
+  }
+  crc = c;
+  for (; len; len--)
+    crc = _mm_crc32_u8 (crc, *p++);
+  return crc;
+}
+
+static bool crc_hw_supported(void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("sse4.2");
+}
+#endif
+
+static uint32_t (*crc_impl)(uint32_t crc, const uint8_t *p, size_t len);
+static GOnce impl_once = G_ONCE_INIT;
+
+static gpointer select_impl(gpointer data)
+{
+  crc_impl = crc32c_sw;
+#ifdef HAVE_CRC_HW
+  if (crc_hw_supported ())
+    crc_impl = crc32c_hw;
+#endif
+  if (crc_impl == crc32c_sw)
+    init_table ();
+  GST_INFO ("crc32c %s", crc_impl == crc32c_sw ? "table" : "hardware");
+  return NULL;
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+  g_once (&impl_once, select_impl, NULL);
+  return ~crc_impl (~crc, p, len);
+}
+
+static int buf_sync(int fd, uint64_t flags)
+{
+  struct dma_buf_sync sync = { .flags = flags | DMA_BUF_SYNC_READ };
+  int rc;
+
+  do {
+    rc = ioctl (fd, DMA_BUF_IOCTL_SYNC, &sync);
+  } while (rc && (errno == EINTR || errno == EAGAIN));
+  return rc;
+}
+
+/* visible rows of one plane, and of UV plane at uv_offset if uv_rows */
+static int plane_crc(const struct csum_plane *pl, int w, int rows,
+    uint32_t *crc)
+{
+  uint8_t *p;
+  int i;
+
+  if (rows <= 0)
+    return 0;
+  if (pl->stride < w ||
+      pl->offset + (size_t)(rows - 1) * pl->stride + w > pl->size) {
+    GST_ERROR ("plane %dx%d stride %d off %zu exceeds %zu",
+        w, rows, pl->stride, pl->offset, pl->size);
+    return -1;
+  }
+  p = mmap (NULL, pl->size, PROT_READ, MAP_SHARED, pl->fd, 0);
+  if (p == MAP_FAILED) {
+    GST_ERROR ("mmap fd %d fail %d", pl->fd, errno);
+    return -1;
+  }
+  buf_sync (pl->fd, DMA_BUF_SYNC_START);
+  for (i = 0; i < rows; i++)
+    *crc = crc32c_update (*crc, p + pl->offset + (size_t)i * pl->stride, w);
+  buf_sync (pl->fd, DMA_BUF_SYNC_END);
+  munmap (p, pl->size);
+  return 0;
+}
+
+static void run_job(struct frame_checksum *c, struct csum_job *j)
+{
+  uint32_t crc = 0;
+  int rc;
+
+  /* UV is subsampled 2x2 but keeps full width in bytes */
+  rc = plane_crc (&j->plane[0], j->w, j->h, &crc) ||
+    plane_crc (&j->plane[1], j->w, (j->h + 1) / 2, &crc);
+  if (!rc) {
+    if (c->out)
+      fprintf (c->out, "%llu %08x\n", (unsigned long long)j->pts, crc);
+    else
+      c->result_cb (c->priv, j->pts, crc);
+  }
+  close (j->plane[0].fd);
+  close (j->plane[1].fd);
+}
+
+static gpointer checksum_thread(gpointer data)
+{
+  struct frame_checksum *c = data;
+  struct csum_job *j;
+
+  prctl (PR_SET_NAME, "aml_v_csum");
+  while ((j = g_async_queue_pop (c->queue)) != &quit_job) {
+    run_job (c, j);
+    c->done_cb (c->priv, j->handle);
+    g_free (j);
+
+    g_mutex_lock (&c->lock);
+    if (!--c->pending)
+      g_cond_broadcast (&c->idle);
+    g_mutex_unlock (&c->lock);
+  }
+  return NULL;
+}
+
+struct frame_checksum *frame_checksum_start(const char *path,
+    csum_result_cb result_cb, csum_done_cb done_cb, void *priv)
+{
+  struct frame_checksum *c = g_new0 (struct frame_checksum, 1);
+
+  if (path) {
+    c->out = fopen (path, "w");
+    if (!c->out) {
+      GST_ERROR ("open %s fail %d", path, errno);
+      g_free (c);
+      return NULL;
+    }
+  }
+  c->result_cb = result_cb;
+  c->done_cb = done_cb;
+  c->priv = priv;
+  g_mutex_init (&c->lock);
+  g_cond_init (&c->idle);
+  c->queue = g_async_queue_new ();
+  c->thread = g_thread_new ("aml_v_csum", checksum_thread, c);
+  return c;
+}
+
+int frame_checksum_submit(struct frame_checksum *c, void *handle,
+    const struct csum_plane plane[2], int w, int h, uint64_t pts_ns)
+{
+  struct csum_job *j = g_new0 (struct csum_job, 1);
+
+  /* own references, decoder side may recycle the gem buffer */
+  j->plane[0] = plane[0];
+  j->plane[1] = plane[1];
+  j->plane[0].fd = dup (plane[0].fd);
+  j->plane[1].fd = dup (plane[1].fd);
+  if (j->plane[0].fd < 0 || j->plane[1].fd < 0) {
+    GST_ERROR ("dup fd fail %d", errno);
+    if (j->plane[0].fd >= 0)
+      close (j->plane[0].fd);
+    if (j->plane[1].fd >= 0)
+      close (j->plane[1].fd);
+    g_free (j);
+    return -1;
+  }
+  j->handle = handle;
+  j->w = w;
+  j->h = h;
+  j->pts = pts_ns;
+
+  g_mutex_lock (&c->lock);
+  c->pending++;
+  g_mutex_unlock (&c->lock);
+  g_async_queue_push (c->queue, j);
+  return 0;
+}
+
+void frame_checksum_flush(struct frame_checksum *c)
+{
+  g_mutex_lock (&c->lock);
+  while (c->pending)
+    g_cond_wait (&c->idle, &c->lock);
+  g_mutex_unlock (&c->lock);
+  if (c->out)
+    fflush (c->out);
+}
+
+void frame_checksum_stop(struct frame_checksum *c)
+{
+  if (!c)
+    return;
+
+  g_async_queue_push (c->queue, &quit_job);
+  g_thread_join (c->thread);
+  g_async_queue_unref (c->queue);
+  if (c->out)
+    fclose (c->out);
+  g_cond_clear (&c->idle);
+  g_mutex_clear (&c->lock);
+  g_free (c);
+}
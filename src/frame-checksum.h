@@ -0,0 +1,55 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef _FRAME_CHECKSUM_H_
+#define _FRAME_CHECKSUM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* checksum of a frame, called on worker when no file is given */
+typedef void (*csum_result_cb)(void *priv, uint64_t pts_ns, uint32_t crc);
+/* worker is done with the buffer, it can go back to decoder */
+typedef void (*csum_done_cb)(void *priv, void *handle);
+
+struct frame_checksum;
+
+/* one NV12 plane as the driver laid it out, offset/size in bytes of fd */
+struct csum_plane {
+  int fd;
+  int stride;
+  size_t offset;
+  size_t size;
+};
+
+/* path NULL reports through result_cb, otherwise "<pts_ns> <crc>" lines */
+struct frame_checksum *frame_checksum_start(const char *path,
+    csum_result_cb result_cb, csum_done_cb done_cb, void *priv);
+/* NV12 frame of w x h visible pixels, plane fds are dup'd and may be
+ * the same fd. handle is passed back to done_cb
+ */
+int frame_checksum_submit(struct frame_checksum *c, void *handle,
+    const struct csum_plane plane[2], int w, int h, uint64_t pts_ns);
+/* wait until every submitted frame is done */
+void frame_checksum_flush(struct frame_checksum *c);
+void frame_checksum_stop(struct frame_checksum *c);
+
+/* CRC32C, hardware instruction when the CPU has it */
+uint32_t crc32c_update(uint32_t crc, const uint8_t *p, size_t len);
+#endif
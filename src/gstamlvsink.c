@@ -16,6 +16,9 @@
  * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
  * MA 02111-1307 USA
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+#endif
 #include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
@@ -23,8 +26,12 @@
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <aml_avsync.h>
 #include <aml_avsync_log.h>
 #include <gst/allocators/gstdmabuf.h>
@@ -34,6 +41,10 @@
 #include "gstamlvsink.h"
 #include "v4l-dec.h"
 #include "display.h"
+#include "cadence.h"
+#include "dec-pool.h"
+#include "es-dump.h"
+#include "frame-checksum.h"
 
 GST_DEBUG_CATEGORY (gst_aml_vsink_debug);
 #define GST_CAT_DEFAULT gst_aml_vsink_debug
@@ -41,6 +52,14 @@ GST_DEBUG_CATEGORY (gst_aml_vsink_debug);
 
 #define PTS_90K 90000
 
+/* double-write-mode value selecting ratio from window size */
+#define VDEC_DW_AUTO 1024
+
+/* reactor wakes for stats and EOS timeout when decoder is idle */
+#define REACTOR_IDLE_MS 100
+/* capture buffers handled per decoder wakeup */
+#define CAPTURE_BATCH_MAX 16
+
 struct src_rect {
   float x;
   float y;
@@ -60,6 +79,8 @@ struct _GstAmlVsinkPrivate
 
   /* for position */
   gint64 position;
+  /* frames flipped before this CLOCK_MONOTONIC ns are stale */
+  guint64 position_epoch;
   GstClockTime first_ts;
   gboolean first_ts_set;
   gint64 start_pts;
@@ -68,6 +89,44 @@ struct _GstAmlVsinkPrivate
   /* curent stream group */
   guint group_id;
   gboolean group_done;
+  /* previous group done before this stream started */
+  gboolean group_switch;
+
+  /* gapless: next stream decoder opened while current one drains */
+  gboolean gapless;
+  gboolean gapless_pending;
+  int next_fd;
+  gboolean next_secure;
+  /* output port of current fd set up by gapless_prepare */
+  gboolean out_preconfigured;
+  /* av sync and queued frames survive decoder switch */
+  gboolean keep_display;
+  GCond drain_done;
+  /* metadata only caps change of running decoder, config re-applied
+   * on next IDR. Codec change goes through the gapless switch
+   */
+  gboolean caps_meta_pending;
+
+  /* standby decoders kept open across instances */
+  int decoder_pool;
+  /* OUTPUT config of pooled fd, format 0 when not configured */
+  struct dec_cfg pool_cfg;
+  /* READY_TO_PAUSED until first frame, us */
+  gint64 zap_start;
+
+  /* ms between stats element messages, 0 for none */
+  guint stats_interval;
+  gint64 stats_next;
+  /* ES capture, location NULL when off */
+  gchar *es_dump_location;
+  struct es_dump *es_dump;
+  /* "bus" or file path, NULL when off */
+  gchar *frame_checksum;
+  struct frame_checksum *csum;
+
+  /* driver counters, refreshed by dq_output thread */
+  struct vdec_cnt dec_cnt;
+  gint64 dec_cnt_next;
 
   /* scaling */
   gboolean scale_set;
@@ -81,12 +140,21 @@ struct _GstAmlVsinkPrivate
 
   gboolean pip;
   gboolean is_2k_only;
+  gboolean shared_display;
+  int black_frame_mode;
 
   /* v4l2 decoder */
   int fd;
   uint32_t dw_mode;
   bool secure;
   gboolean dw_mode_user_set;
+  /* auto double write, re-picked on key frame after window change */
+  gboolean dw_auto;
+  gboolean dw_reselect;
+  guint64 dw_bw_saved;
+  /* decode and scan out AFBC only, no linear double write */
+  gboolean afbc_scanout;
+  gboolean afbc_active;
   uint32_t output_format;
   uint32_t output_mode;
   struct v4l2_fmtdesc *output_formats;
@@ -109,9 +177,40 @@ struct _GstAmlVsinkPrivate
   gboolean quitdqOutputBufferThread;
   GThread *dqOutputBufferThread;
 
-  /* eos wating thread */
-  gboolean quit_eos_wait;
-  GThread *eos_wait_thread;
+  /* pre-warm of display and decoder before NULL to READY */
+  gboolean prewarm;
+  GThread *prewarm_thread;
+  void *prewarm_render;
+  gboolean prewarm_pip;
+  gboolean prewarm_ll;
+  gboolean prewarm_shared;
+  int prewarm_fd;
+  struct v4l2_fmtdesc *prewarm_out_formats;
+  struct v4l2_fmtdesc *prewarm_cap_formats;
+
+  /* eventfd written by display when last frame is on screen */
+  int eos_fd;
+  gboolean eos_posted;
+  /* monotonic us when decoder was asked to drain */
+  gint64 eos_start;
+
+  /* one epoll loop serves capture, OUTPUT reclaim and events */
+  gboolean reactor;
+  /* latched when threads start */
+  gboolean reactor_active;
+  /* eventfd waking the reactor on quit */
+  int ctl_fd;
+  /* epoll events armed on decoder fd */
+  uint32_t reactor_events;
+  /* OUTPUT was ready on last wake, drained once capture is handled */
+  gboolean reactor_reclaim;
+  /* context switches of decode and dq_output threads, sampled at 1 Hz */
+  gint dec_csw;
+  gint dqout_csw;
+  gint64 dec_csw_next;
+  gint64 dqout_csw_next;
+  /* decoder wakeups that handed frames to display */
+  gint capture_batches;
 
   /* render */
   void *render;
@@ -120,9 +219,15 @@ struct _GstAmlVsinkPrivate
   int sessionId;
   uint32_t delay;
   gboolean low_latency;
+  /* frame selection of immediate output */
+  int ll_policy;
+  guint ll_param;
 
   GstCaps *caps;
 
+  /* frame duration from decoded timestamps */
+  struct cadence cadence;
+
   /* ES info from caps */
   int fr;
   int es_width;
@@ -180,6 +285,10 @@ struct _GstAmlVsinkPrivate
   gint buf_dec_num;
   gint buf_dis_num;
 
+  /* latency reported to pipeline */
+  GstClockTime latency_min;
+  GstClockTime latency_max;
+
   gboolean use_ext_ctrls;
 };
 
@@ -203,6 +312,18 @@ enum
   PROP_VIDEO_INTERLACED,
   PROP_IMMEDIATE_OUTPUT,
   PROP_START_PTS,
+  PROP_SHARED_DISPLAY,
+  PROP_AFBC_SCANOUT,
+  PROP_LL_POLICY,
+  PROP_PREWARM,
+  PROP_BLACK_FRAME_MODE,
+  PROP_GAPLESS,
+  PROP_DECODER_POOL,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_ES_DUMP_LOCATION,
+  PROP_FRAME_CHECKSUM,
+  PROP_REACTOR,
   PROP_LAST
 };
 
@@ -227,6 +348,7 @@ enum
   SIGNAL_PAUSEPTS,
   SIGNAL_UNDERFLOW,
   SIGNAL_VIDEO_CHANGE,
+  SIGNAL_ANIMATE_WINDOW,
   MAX_SIGNAL
 };
 static guint g_signals[MAX_SIGNAL]= {0};
@@ -250,20 +372,39 @@ static GstFlowReturn gst_aml_vsink_chain (GstPad * pad, GstObject * parent, GstB
 static gboolean gst_aml_vsink_event(GstAmlVsink *sink, GstEvent * event);
 static gboolean gst_aml_vsink_pad_event (GstPad * pad, GstObject * parent, GstEvent * event);
 static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps);
+static gboolean gst_aml_vsink_animate_window (GstAmlVsink *sink, gint x, gint y,
+    gint w, gint h, guint duration, gint easing);
 
 static void reset_decoder(GstAmlVsink *sink, bool hard);
+static void gapless_prepare(GstAmlVsink *sink);
+static void set_decoder_eos(GstAmlVsinkPrivate *priv, gboolean eos);
+static void gapless_handover(GstAmlVsink *sink, gboolean secure);
+static gboolean wait_drained(GstAmlVsinkPrivate *priv);
+static void caps_meta_apply(GstAmlVsink *sink);
+static void prewarm_start(GstAmlVsink *sink);
+static void prewarm_join(GstAmlVsink *sink);
+static void prewarm_release(GstAmlVsinkPrivate *priv);
 static gboolean check_vdec(GstAmlVsinkClass *klass);
 static int capture_buffer_recycle(void* priv_data, void* handle, bool displayed, bool recycled);
+static int release_capture_buffer(GstAmlVsinkPrivate *priv,
+    struct capture_buffer *frame);
+static void checksum_result(void *priv_data, uint64_t pts_ns, uint32_t crc);
+static void checksum_done(void *priv_data, void *handle);
 static int pause_pts_arrived(void* priv, uint32_t pts);
+static void calc_stretch_window(GstAmlVsinkPrivate *priv);
+static uint32_t pick_auto_dw_mode(GstAmlVsinkPrivate *priv);
+static void report_dw_bandwidth(GstAmlVsink *sink);
+static void reselect_auto_dw(GstAmlVsink *sink);
+static void afbc_fallback(GstAmlVsink *sink, const char *reason);
 static void update_stretch_window(GstAmlVsinkPrivate *priv);
 //static int get_sysfs_uint32(const char *path, uint32_t *value);
 //static int config_sys_node(const char* path, const char* value);
 static int buffer_underflow_happened(void* handle, uint32_t pts);
-#define DUMP_TO_FILE
-#ifdef DUMP_TO_FILE
-static guint file_index;
-static void dump(const char* path, const uint8_t *data, int size, gboolean vp9, int frame_cnt);
-#endif
+static void compute_latency(GstAmlVsinkPrivate *priv, GstClockTime *min, GstClockTime *max);
+static void update_latency(GstAmlVsink *sink);
+static gint64 get_position(GstAmlVsinkPrivate *priv);
+static GstStructure *build_stats(GstAmlVsinkPrivate *priv);
+static void post_stats(GstAmlVsink *sink);
 
 static void
 gst_aml_vsink_class_init (GstAmlVsinkClass * klass)
@@ -324,8 +465,9 @@ gst_aml_vsink_class_init (GstAmlVsinkClass * klass)
 
   g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_VIDEO_DW_MODE,
       g_param_spec_int ("double-write-mode", "double-write-mode",
-        "0/1/2/4/16/256/512 Only 16 is valid for h264/mepg2.",
-        0, 512, 0, G_PARAM_WRITABLE));
+        "0/1/2/4/16/256/512 Only 16 is valid for h264/mepg2. "
+        "1024: pick 1:1/1:2/1:4 from window size",
+        0, VDEC_DW_AUTO, 0, G_PARAM_WRITABLE));
 
   g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PAUSE_PTS,
       g_param_spec_uint ("pause-pts", "pause pts",
@@ -377,6 +519,70 @@ gst_aml_vsink_class_init (GstAmlVsinkClass * klass)
         "In 90K Hz, all video frame less than start pts will be dropped",
         0, G_MAXUINT, G_MAXUINT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_SHARED_DISPLAY,
+      g_param_spec_boolean ("shared-display", "shared display",
+        "Share one vsync thread and DRM device with other sinks (main + pip) in the process, set it in NULL state",
+        FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_AFBC_SCANOUT,
+      g_param_spec_boolean ("afbc-scanout", "afbc scanout",
+        "Display AFBC compressed frames directly without linear double write when video plane supports it",
+        FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_LL_POLICY,
+      g_param_spec_string ("immediate-output-policy", "immediate output policy",
+        "Frame selection with immediate-output: latest (default), fifo,<depth> or deadline,<ms>",
+        "latest", G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PREWARM,
+      g_param_spec_boolean ("prewarm", "prewarm",
+        "Start display and open decoder on a worker thread right away, set it in NULL state after pip/immediate-output/shared-display",
+        FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_BLACK_FRAME_MODE,
+      g_param_spec_int ("black-frame-mode", "black frame mode",
+        "0 (post black frame buffer, default), 1 (turn video plane off)",
+        BLACK_FRAME_BUFFER, BLACK_FRAME_PLANE_OFF, BLACK_FRAME_BUFFER, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_GAPLESS,
+      g_param_spec_boolean ("gapless", "gapless",
+        "Open next decoder on new caps after stream group done and switch to it once current stream drained, without flushing display",
+        FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_DECODER_POOL,
+      g_param_spec_int ("decoder-pool", "decoder pool",
+        "Keep this many decoders (process wide) opened and configured for last stream, so next sink starts without opening one",
+        0, DEC_POOL_MAX, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_STATS,
+      g_param_spec_boxed ("stats", "stats",
+        "Snapshot of frame counters and decoder/display queue depths",
+        GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "stats interval",
+        "Post stats as element message every this many ms while decoding, 0 (default) to disable",
+        0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_ES_DUMP_LOCATION,
+      g_param_spec_string ("es-dump-location", "es dump location",
+        "Dump input ES of non-secure streams to <location>-<n>.<ivf|h264|h265|es> with <location>-<n>.idx, "
+        "takes effect on next stream. AML_VSINK_ES_DUMP=<location> sets the default",
+        NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_FRAME_CHECKSUM,
+      g_param_spec_string ("frame-checksum", "frame checksum",
+        "CRC32C of visible NV12 of every decoded non-secure linear frame, \"bus\" posts "
+        "amlvsink-checksum element messages, otherwise file path for \"<pts_ns> <crc>\" lines. "
+        "Takes effect on READY_TO_PAUSED",
+        NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_REACTOR,
+      g_param_spec_boolean ("reactor", "reactor",
+        "Serve capture frames, OUTPUT buffer reclaim and decoder events from one epoll loop "
+        "instead of separate polling threads, takes effect on next stream",
+        FALSE, G_PARAM_READWRITE));
+
   g_signals[SIGNAL_FIRSTFRAME]= g_signal_new( "first-video-frame-callback",
       G_TYPE_FROM_CLASS(GST_ELEMENT_CLASS(klass)),
       (GSignalFlags) (G_SIGNAL_RUN_LAST),
@@ -425,6 +631,25 @@ gst_aml_vsink_class_init (GstAmlVsinkClass * klass)
       G_TYPE_UINT,
       G_TYPE_POINTER);
 
+  /* animate window from current position to (x,y,w,h) in duration ms */
+  g_signals[SIGNAL_ANIMATE_WINDOW]= g_signal_new( "animate-window",
+      G_TYPE_FROM_CLASS(GST_ELEMENT_CLASS(klass)),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstAmlVsinkClass, animate_window),
+      NULL, /* accumulator */
+      NULL, /* accu data */
+      NULL, /* generic marshaller */
+      G_TYPE_BOOLEAN,
+      6,
+      G_TYPE_INT,
+      G_TYPE_INT,
+      G_TYPE_INT,
+      G_TYPE_INT,
+      G_TYPE_UINT,
+      GST_TYPE_AML_VSINK_EASING);
+
+  klass->animate_window = gst_aml_vsink_animate_window;
+
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_aml_vsink_change_state);
   gstelement_class->query = GST_DEBUG_FUNCPTR (gst_aml_vsink_query);
@@ -432,18 +657,16 @@ gst_aml_vsink_class_init (GstAmlVsinkClass * klass)
   gstbasesink_class->set_caps = GST_DEBUG_FUNCPTR (gst_aml_vsink_setcaps);
 }
 
-static gboolean build_caps(GstAmlVsinkClass*klass, struct v4l2_fmtdesc *formats, uint32_t fnum)
+static GstCaps *build_caps(struct v4l2_fmtdesc *formats, uint32_t fnum)
 {
-  gboolean ret = FALSE;
   GstCaps *caps = 0;
   GstCaps *tmp = 0;
-  GstPadTemplate *padTemplate= 0;
   int i;
 
   caps= gst_caps_new_empty();
   if (!caps ) {
     GST_ERROR("gst_caps_new_empty failed");
-    return FALSE;
+    return NULL;
   }
 
   for (i= 0; i < fnum; ++i) {
@@ -511,6 +734,13 @@ static gboolean build_caps(GstAmlVsinkClass*klass, struct v4l2_fmtdesc *formats,
       tmp = NULL;
     }
   }
+  return caps;
+}
+
+static gboolean add_sink_template(GstAmlVsinkClass *klass, GstCaps *caps)
+{
+  gboolean ret = FALSE;
+  GstPadTemplate *padTemplate= 0;
 
   padTemplate= gst_pad_template_new( "sink",
       GST_PAD_SINK,
@@ -531,12 +761,87 @@ error:
   return ret;
 }
 
+#define CAPS_CACHE_GROUP "vdec"
+
+static gchar *caps_cache_path(void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gstreamer-1.0",
+      "amlvsink-caps.ini", NULL);
+}
+
+/* caps probed earlier with same device, driver, module and kernel */
+static GstCaps *load_cached_caps(const gchar *key)
+{
+  GKeyFile *kf = g_key_file_new ();
+  gchar *path = caps_cache_path ();
+  gchar *cached_key = NULL;
+  gchar *str = NULL;
+  GstCaps *caps = NULL;
+
+  if (!g_key_file_load_from_file (kf, path, G_KEY_FILE_NONE, NULL))
+    goto exit;
+
+  cached_key = g_key_file_get_string (kf, CAPS_CACHE_GROUP, "key", NULL);
+  if (g_strcmp0 (cached_key, key)) {
+    GST_INFO ("caps cache key changed, reprobe");
+    goto exit;
+  }
+
+  str = g_key_file_get_string (kf, CAPS_CACHE_GROUP, "caps", NULL);
+  if (str)
+    caps = gst_caps_from_string (str);
+  if (caps)
+    GST_DEBUG ("caps from cache %s", path);
+
+exit:
+  g_free (str);
+  g_free (cached_key);
+  g_free (path);
+  g_key_file_free (kf);
+  return caps;
+}
+
+static void save_cached_caps(const gchar *key, GstCaps *caps)
+{
+  GKeyFile *kf = g_key_file_new ();
+  gchar *path = caps_cache_path ();
+  gchar *dir = g_path_get_dirname (path);
+  gchar *str = gst_caps_to_string (caps);
+  gchar *data;
+  gsize len;
+  GError *err = NULL;
+
+  g_key_file_set_string (kf, CAPS_CACHE_GROUP, "key", key);
+  g_key_file_set_string (kf, CAPS_CACHE_GROUP, "caps", str);
+  data = g_key_file_to_data (kf, &len, NULL);
+
+  /* g_file_set_contents renames, readers never see partial file */
+  if (g_mkdir_with_parents (dir, 0755) ||
+      !g_file_set_contents (path, data, len, &err)) {
+    GST_WARNING ("fail to save caps cache %s: %s", path,
+        err ? err->message : "mkdir");
+    g_clear_error (&err);
+  }
+
+  g_free (data);
+  g_free (str);
+  g_free (dir);
+  g_free (path);
+  g_key_file_free (kf);
+}
+
 static gboolean check_vdec(GstAmlVsinkClass *klass)
 {
   gboolean ret = FALSE;
   int fd = -1;
   uint32_t fnum;
   struct v4l2_fmtdesc *formats = NULL;
+  gchar *key = v4l_dec_cache_key ();
+  GstCaps *caps;
+
+  caps = load_cached_caps (key);
+  if (caps)
+    goto done;
 
   GST_TRACE ("open vdec");
   fd = v4l_dec_open (true);
@@ -551,21 +856,29 @@ static gboolean check_vdec(GstAmlVsinkClass *klass)
     goto error;
   }
 
-  if (!build_caps (klass, formats, fnum)) {
+  caps = build_caps (formats, fnum);
+  if (!caps) {
     GST_ERROR ("can not build caps");
     goto error;
   }
+  save_cached_caps (key, caps);
+
+done:
+  if (!add_sink_template (klass, caps)) {
+    GST_ERROR ("can not add pad template");
+    goto error;
+  }
 
   GST_TRACE ("done");
-  close (fd);
   ret = TRUE;
 error:
-  if (fd > 0)
+  if (fd >= 0)
     close (fd);
 
   if (formats)
     g_free (formats);
 
+  g_free (key);
   return ret;
 }
 
@@ -573,6 +886,7 @@ static void
 gst_aml_vsink_init (GstAmlVsink* sink)
 {
   GstBaseSink *basesink;
+  const char *env;
 #if GST_CHECK_VERSION(1,14,0)
   GstAmlVsinkPrivate *priv = gst_aml_vsink_get_instance_private (sink);
 #else
@@ -588,6 +902,7 @@ gst_aml_vsink_init (GstAmlVsink* sink)
   gst_pad_set_chain_function (basesink->sinkpad, gst_aml_vsink_chain);
 
   g_cond_init (&priv->output_buffer_available);
+  g_cond_init (&priv->drain_done);
   g_mutex_init (&priv->output_buffer_lock);
   pthread_mutex_init (&priv->res_lock, NULL);
   priv->received_eos = FALSE;
@@ -608,6 +923,20 @@ gst_aml_vsink_init (GstAmlVsink* sink)
   priv->buf_dis_num = 0;
   priv->buf_dec_num = 0;
   priv->ob_available_num = 0;
+  priv->latency_min = 0;
+  priv->latency_max = 0;
+  priv->prewarm_fd = -1;
+  priv->next_fd = -1;
+  /* read once, not per buffer */
+  env = getenv ("AML_VSINK_ES_DUMP");
+  if (env)
+    priv->es_dump_location = g_strdup (*env == '/' ? env : "/tmp/amlvsink");
+  priv->eos_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (priv->eos_fd < 0)
+    GST_ERROR_OBJECT (sink, "eventfd fail %d", errno);
+  priv->ctl_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (priv->ctl_fd < 0)
+    GST_ERROR_OBJECT (sink, "eventfd fail %d", errno);
 }
 
 static void
@@ -617,7 +946,25 @@ gst_aml_vsink_dispose (GObject * object)
   GstAmlVsinkPrivate *priv = sink->priv;
 
   GST_INFO_OBJECT(sink, "dispose");
+  prewarm_join (sink);
+  prewarm_release (priv);
+  es_dump_close (priv->es_dump);
+  priv->es_dump = NULL;
+  g_free (priv->es_dump_location);
+  priv->es_dump_location = NULL;
+  g_free (priv->frame_checksum);
+  priv->frame_checksum = NULL;
+  gst_caps_replace (&priv->caps, NULL);
+  if (priv->eos_fd >= 0) {
+    close (priv->eos_fd);
+    priv->eos_fd = -1;
+  }
+  if (priv->ctl_fd >= 0) {
+    close (priv->ctl_fd);
+    priv->ctl_fd = -1;
+  }
   g_cond_clear (&priv->output_buffer_available);
+  g_cond_clear (&priv->drain_done);
   g_mutex_clear (&priv->output_buffer_lock);
   pthread_mutex_destroy (&priv->res_lock);
   G_OBJECT_CLASS (parent_class)->dispose (object);
@@ -635,7 +982,20 @@ gst_aml_vsink_query (GstElement * element, GstQuery * query)
   switch (GST_QUERY_TYPE (query)) {
     case GST_QUERY_LATENCY:
     {
-      gst_query_set_latency (query, FALSE, 0, 10*1000*1000);
+      gboolean live = FALSE;
+      GstClockTime min = 0, max = GST_CLOCK_TIME_NONE;
+      GstClockTime own_min, own_max;
+
+      if (gst_pad_peer_query (GST_AML_VSINK_PAD (sink), query))
+        gst_query_parse_latency (query, &live, &min, &max);
+
+      compute_latency (priv, &own_min, &own_max);
+      min += own_min;
+      if (GST_CLOCK_TIME_IS_VALID (max))
+        max += own_max;
+      GST_LOG_OBJECT (sink, "latency live %d min %" GST_TIME_FORMAT
+          " max %" GST_TIME_FORMAT, live, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+      gst_query_set_latency (query, live, min, max);
       res = TRUE;
       break;
     }
@@ -647,8 +1007,10 @@ gst_aml_vsink_query (GstElement * element, GstQuery * query)
       if (GST_FORMAT_BYTES == format)
         return GST_ELEMENT_CLASS (parent_class)->query (element, query);
       if (priv->first_ts_set) {
-        GST_LOG_OBJECT(sink, "POSITION: %lld", priv->position);
-        gst_query_set_position (query, GST_FORMAT_TIME, priv->position);
+        gint64 position = get_position (priv);
+
+        GST_LOG_OBJECT(sink, "POSITION: %lld", position);
+        gst_query_set_position (query, GST_FORMAT_TIME, position);
         res = TRUE;
       }
       break;
@@ -673,6 +1035,7 @@ gst_aml_vsink_set_property (GObject * object, guint property_id,
     priv->delay = g_value_get_uint (value);
     display_set_video_delay(priv->render, priv->delay);
     GST_WARNING_OBJECT (sink, "render delay %u ms", priv->delay);
+    update_latency (sink);
     break;
   }
   case PROP_PAUSE_PTS:
@@ -705,7 +1068,12 @@ gst_aml_vsink_set_property (GObject * object, guint property_id,
         mode == VDEC_DW_AFBC_AUTO_1_4) {
       priv->dw_mode = mode;
       priv->dw_mode_user_set = TRUE;
+      priv->dw_auto = FALSE;
       GST_WARNING_OBJECT (sink, "double write mode %d", priv->dw_mode);
+    } else if (mode == VDEC_DW_AUTO) {
+      priv->dw_mode_user_set = FALSE;
+      priv->dw_auto = TRUE;
+      GST_WARNING_OBJECT (sink, "auto double write mode");
     } else {
       GST_ERROR_OBJECT (sink, "invalid dw mode %d", priv->dw_mode);
     }
@@ -812,8 +1180,11 @@ gst_aml_vsink_set_property (GObject * object, guint property_id,
         priv->window.w = nw;
         priv->window.h = nh;
 
-        if (priv->visible_w && priv->visible_h)
+        if (priv->stretch_mode == 0)
+          display_engine_set_dst_rect (priv->render, &priv->window);
+        else if (priv->visible_w && priv->visible_h)
           update_stretch_window(priv);
+        priv->dw_reselect = priv->dw_auto;
 
         if (priv->avsync_paused) {
           struct rect *win;
@@ -824,16 +1195,17 @@ gst_aml_vsink_set_property (GObject * object, guint property_id,
           else
             win = &priv->stretch_window;
 
+          /* same as frame source window, in double write dimension */
           if (priv->src_rec_set) {
-            src_win.x = priv->visible_w * priv->source_window.x;
-            src_win.y = priv->visible_h * priv->source_window.y;
-            src_win.w = priv->visible_w * priv->source_window.w;
-            src_win.h = priv->visible_h * priv->source_window.h;
+            src_win.x = priv->visible_dw_w * priv->source_window.x;
+            src_win.y = priv->visible_dw_h * priv->source_window.y;
+            src_win.w = priv->visible_dw_w * priv->source_window.w;
+            src_win.h = priv->visible_dw_h * priv->source_window.h;
           } else {
             src_win.x = 0;
             src_win.y = 0;
-            src_win.w = priv->visible_w;
-            src_win.h = priv->visible_h;
+            src_win.w = priv->visible_dw_w;
+            src_win.h = priv->visible_dw_h;
           }
           if (priv->render)
             display_engine_refresh (priv->render, win, &src_win);
@@ -870,6 +1242,113 @@ gst_aml_vsink_set_property (GObject * object, guint property_id,
     GST_WARNING ("start pts %lld", priv->start_pts);
     break;
   }
+  case PROP_SHARED_DISPLAY:
+  {
+    priv->shared_display = g_value_get_boolean (value);
+    GST_WARNING_OBJECT (sink, "shared display %d", priv->shared_display);
+    break;
+  }
+  case PROP_AFBC_SCANOUT:
+  {
+    priv->afbc_scanout = g_value_get_boolean (value);
+    GST_WARNING_OBJECT (sink, "afbc scanout %d", priv->afbc_scanout);
+    break;
+  }
+  case PROP_BLACK_FRAME_MODE:
+  {
+    priv->black_frame_mode = g_value_get_int (value);
+    GST_OBJECT_LOCK (sink);
+    if (priv->render)
+      display_set_black_frame_mode (priv->render, priv->black_frame_mode);
+    GST_OBJECT_UNLOCK (sink);
+    GST_WARNING_OBJECT (sink, "black frame mode %d", priv->black_frame_mode);
+    break;
+  }
+  case PROP_GAPLESS:
+  {
+    priv->gapless = g_value_get_boolean (value);
+    GST_WARNING_OBJECT (sink, "gapless %d", priv->gapless);
+    break;
+  }
+  case PROP_REACTOR:
+  {
+    priv->reactor = g_value_get_boolean (value);
+    GST_WARNING_OBJECT (sink, "reactor %d", priv->reactor);
+    break;
+  }
+  case PROP_ES_DUMP_LOCATION:
+  {
+    const gchar *str = g_value_get_string (value);
+
+    GST_OBJECT_LOCK (sink);
+    g_free (priv->es_dump_location);
+    priv->es_dump_location = (str && *str) ? g_strdup (str) : NULL;
+    GST_OBJECT_UNLOCK (sink);
+    GST_WARNING_OBJECT (sink, "es dump location %s", str ? str : "(null)");
+    break;
+  }
+  case PROP_FRAME_CHECKSUM:
+  {
+    const gchar *str = g_value_get_string (value);
+
+    GST_OBJECT_LOCK (sink);
+    g_free (priv->frame_checksum);
+    priv->frame_checksum = (str && *str) ? g_strdup (str) : NULL;
+    GST_OBJECT_UNLOCK (sink);
+    GST_WARNING_OBJECT (sink, "frame checksum %s", str ? str : "(null)");
+    break;
+  }
+  case PROP_STATS_INTERVAL:
+  {
+    g_atomic_int_set (&priv->stats_interval, g_value_get_uint (value));
+    priv->stats_next = 0;
+    GST_WARNING_OBJECT (sink, "stats interval %u ms", priv->stats_interval);
+    break;
+  }
+  case PROP_DECODER_POOL:
+  {
+    priv->decoder_pool = g_value_get_int (value);
+    GST_WARNING_OBJECT (sink, "decoder pool %d", priv->decoder_pool);
+    dec_pool_set_size (priv->decoder_pool);
+    break;
+  }
+  case PROP_PREWARM:
+  {
+    priv->prewarm = g_value_get_boolean (value);
+    GST_WARNING_OBJECT (sink, "prewarm %d", priv->prewarm);
+    if (priv->prewarm)
+      prewarm_start (sink);
+    break;
+  }
+  case PROP_LL_POLICY:
+  {
+    const gchar *str = g_value_get_string (value);
+    gchar **parts = g_strsplit (str ? str : "latest", ",", 2);
+
+    if (!g_strcmp0 (parts[0], "latest")) {
+      priv->ll_policy = LL_POLICY_LATEST;
+      priv->ll_param = 0;
+    } else if (!g_strcmp0 (parts[0], "fifo") && parts[1] && atoi(parts[1]) > 0) {
+      priv->ll_policy = LL_POLICY_FIFO;
+      priv->ll_param = atoi(parts[1]);
+    } else if (!g_strcmp0 (parts[0], "deadline") && parts[1] && atoi(parts[1]) >= 0) {
+      priv->ll_policy = LL_POLICY_DEADLINE;
+      priv->ll_param = atoi(parts[1]);
+    } else {
+      GST_ERROR_OBJECT (sink, "bad immediate output policy %s", str);
+      g_strfreev(parts);
+      break;
+    }
+    g_strfreev(parts);
+
+    GST_OBJECT_LOCK (sink);
+    if (priv->render)
+      display_set_ll_policy (priv->render, priv->ll_policy, priv->ll_param);
+    GST_OBJECT_UNLOCK (sink);
+    GST_WARNING_OBJECT (sink, "immediate output policy %d param %u",
+        priv->ll_policy, priv->ll_param);
+    break;
+  }
   default:
   G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   break;
@@ -910,7 +1389,7 @@ static void gst_aml_vsink_get_property (GObject * object, guint property_id,
   }
   case PROP_VIDEO_FRAME_DROP_NUM:
   {
-    g_value_set_int(value, priv->dropped_frame_num);
+    g_value_set_int(value, g_atomic_int_get (&priv->dropped_frame_num));
     break;
   }
   case PROP_STRETCH_MODE:
@@ -928,6 +1407,75 @@ static void gst_aml_vsink_get_property (GObject * object, guint property_id,
     g_value_set_int(value, gst_util_uint64_scale_int (priv->start_pts, 90000, GST_SECOND));
     break;
   }
+  case PROP_SHARED_DISPLAY:
+  {
+    g_value_set_boolean(value, priv->shared_display);
+    break;
+  }
+  case PROP_AFBC_SCANOUT:
+  {
+    g_value_set_boolean(value, priv->afbc_scanout);
+    break;
+  }
+  case PROP_BLACK_FRAME_MODE:
+  {
+    g_value_set_int(value, priv->black_frame_mode);
+    break;
+  }
+  case PROP_PREWARM:
+  {
+    g_value_set_boolean(value, priv->prewarm);
+    break;
+  }
+  case PROP_GAPLESS:
+  {
+    g_value_set_boolean(value, priv->gapless);
+    break;
+  }
+  case PROP_REACTOR:
+  {
+    g_value_set_boolean(value, priv->reactor);
+    break;
+  }
+  case PROP_DECODER_POOL:
+  {
+    g_value_set_int(value, priv->decoder_pool);
+    break;
+  }
+  case PROP_STATS:
+  {
+    g_value_take_boxed(value, build_stats (priv));
+    break;
+  }
+  case PROP_ES_DUMP_LOCATION:
+  {
+    GST_OBJECT_LOCK (sink);
+    g_value_set_string(value, priv->es_dump_location);
+    GST_OBJECT_UNLOCK (sink);
+    break;
+  }
+  case PROP_FRAME_CHECKSUM:
+  {
+    GST_OBJECT_LOCK (sink);
+    g_value_set_string(value, priv->frame_checksum);
+    GST_OBJECT_UNLOCK (sink);
+    break;
+  }
+  case PROP_STATS_INTERVAL:
+  {
+    g_value_set_uint(value, g_atomic_int_get (&priv->stats_interval));
+    break;
+  }
+  case PROP_LL_POLICY:
+  {
+    if (priv->ll_policy == LL_POLICY_FIFO)
+      g_value_take_string (value, g_strdup_printf ("fifo,%u", priv->ll_param));
+    else if (priv->ll_policy == LL_POLICY_DEADLINE)
+      g_value_take_string (value, g_strdup_printf ("deadline,%u", priv->ll_param));
+    else
+      g_value_set_string (value, "latest");
+    break;
+  }
   default:
   {
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -944,6 +1492,9 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
   const gchar *mime;
   int len;
   gint num, denom, width, height;
+  gboolean gapless, running, codec_switch, meta_changed = FALSE;
+  int old_format, old_fr;
+  struct hdr_meta old_hdr;
 
   if (G_UNLIKELY (priv->caps && gst_caps_is_equal (priv->caps, caps))) {
     GST_DEBUG_OBJECT (sink,
@@ -951,6 +1502,16 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
     return TRUE;
   }
 
+  /* caps of next playlist item while current decoder is running */
+  gapless = priv->gapless && priv->group_switch &&
+      priv->output_port_config && !priv->gapless_pending;
+  priv->group_switch = FALSE;
+  /* same stream, caps changed in-band */
+  running = priv->output_port_config && !gapless && !priv->gapless_pending;
+  old_format = priv->output_format;
+  old_fr = priv->fr;
+  old_hdr = priv->hdr;
+
   gchar *str= gst_caps_to_string (caps);
   GST_INFO ("caps: %s", str);
   g_free(str);
@@ -988,6 +1549,7 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
     GST_ERROR("not accepting format(%s)", mime );
     goto error;
   }
+  codec_switch = running && priv->output_format != old_format;
 
   /* codec data */
   if (gst_structure_has_field (structure, "codec_data")) {
@@ -1012,6 +1574,7 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
             memcpy(priv->codec_data, map.data, map.size);
             priv->codec_data_len = map.size;
             priv->codec_data_injected = FALSE;
+            meta_changed = TRUE;
           } else {
             GST_ERROR("no memory for codec data size %d", map.size);
             has_error = TRUE;
@@ -1050,7 +1613,10 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
   else
       priv->es_width = -1;
 
-  /* setup double write mode */
+  /* setup double write mode, running decoder keeps its own */
+  if (running && !codec_switch)
+    goto hdr;
+  priv->afbc_active = FALSE;
   switch (priv->output_format) {
   case V4L2_PIX_FMT_MPEG:
   case V4L2_PIX_FMT_MPEG1:
@@ -1070,6 +1636,22 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
       GST_WARNING_OBJECT (sink, "enforce user dw mode %d", priv->dw_mode);
       break;
     }
+    /* h264 decoder has no AFBC output */
+    if (priv->afbc_scanout && priv->output_format != V4L2_PIX_FMT_H264 &&
+        display_afbc_supported (priv->render)) {
+      priv->dw_mode = VDEC_DW_AFBC_ONLY;
+      priv->afbc_active = TRUE;
+      break;
+    }
+    if (priv->dw_auto) {
+      /* stats snapshot reads dw state under object lock */
+      GST_OBJECT_LOCK (sink);
+      priv->dw_mode = pick_auto_dw_mode (priv);
+      report_dw_bandwidth (sink);
+      GST_OBJECT_UNLOCK (sink);
+      priv->dw_reselect = FALSE;
+      break;
+    }
     priv->dw_mode = VDEC_DW_AFBC_1_4_DW;
 #if 0
     priv->dw_mode = VDEC_DW_AFBC_ONLY;
@@ -1082,7 +1664,9 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
   }
   GST_WARNING_OBJECT (sink, "dw mode %d", priv->dw_mode);
 
-  /* HDR */
+hdr:
+  /* HDR, fields missing from the new caps must not keep old values */
+  memset (&priv->hdr, 0, sizeof(priv->hdr));
 	if (gst_structure_has_field(structure, "colorimetry")) {
 		const char *colorimetry = gst_structure_get_string (structure,"colorimetry");
 
@@ -1185,6 +1769,27 @@ static gboolean gst_aml_vsink_setcaps (GstBaseSink * bsink, GstCaps * caps)
 		}
 	}
 
+  if (gapless) {
+    gapless_prepare (sink);
+  } else if (codec_switch) {
+    /* decoder can not change codec in place, drain into a fresh one */
+    GST_WARNING_OBJECT (sink, "codec switch %x --> %x",
+        old_format, priv->output_format);
+    gapless_prepare (sink);
+  } else if (running) {
+    meta_changed |= priv->fr != old_fr ||
+      !hdr_meta_equal (&priv->hdr, &old_hdr);
+    if (meta_changed) {
+      GST_INFO_OBJECT (sink, "stream metadata changed, apply on next IDR");
+      GST_OBJECT_LOCK (sink);
+      priv->caps_meta_pending = TRUE;
+      GST_OBJECT_UNLOCK (sink);
+    }
+  }
+  gst_caps_replace (&priv->caps, caps);
+
+  /* frame rate affects frame based latency */
+  update_latency (sink);
   return TRUE;
 error:
   return FALSE;
@@ -1204,62 +1809,73 @@ static inline void vsink_reset (GstAmlVsink * sink)
   priv->capture_port_config = FALSE;
   priv->buf_underflow_fired = FALSE;
   priv->position = 0;
+  priv->position_epoch = g_get_monotonic_time () * 1000;
+  cadence_reset (&priv->cadence);
+  priv->eos_posted = FALSE;
+  priv->eos_start = 0;
+  memset (&priv->dec_cnt, 0, sizeof(priv->dec_cnt));
+  priv->dec_cnt_next = 0;
+  priv->gapless_pending = FALSE;
+  priv->out_preconfigured = FALSE;
+  priv->caps_meta_pending = FALSE;
+  if (priv->next_fd >= 0) {
+    v4l_unreg_event (priv->next_fd);
+    close (priv->next_fd);
+    priv->next_fd = -1;
+  }
+  display_engine_set_eos (priv->render, false);
+  if (priv->eos_fd >= 0) {
+    uint64_t cnt;
+
+    /* drop notification of flushed stream */
+    if (read (priv->eos_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+      GST_WARNING ("eos fd read %d", errno);
+  }
 }
 
-static gpointer video_eos_thread(gpointer data)
+static void post_eos(GstAmlVsink *sink)
 {
-  GstAmlVsink * sink = data;
   GstAmlVsinkPrivate *priv = sink->priv;
-  uint32_t count = 3000; //30s timeout
-
-  prctl (PR_SET_NAME, "aml_eos_t");
-  GST_INFO ("enter");
-
-  while (!priv->quit_eos_wait) {
-    usleep (10000);
-    count--;
-    if (priv->eos || !count) {
-      GstMessage * message;
-
-      if (!count)
-        GST_WARNING_OBJECT (sink, "EOS timeout");
-      GST_WARNING_OBJECT (sink, "Posting EOS");
-      message = gst_message_new_eos (GST_OBJECT_CAST (sink));
-      gst_message_set_seqnum (message, priv->seqnum);
-      gst_element_post_message (GST_ELEMENT_CAST (sink), message);
-      break;
-    }
+  GstMessage * message;
+
+  GST_OBJECT_LOCK (sink);
+  if (!priv->received_eos || priv->eos_posted || priv->flushing_) {
+    GST_OBJECT_UNLOCK (sink);
+    return;
   }
-  GST_INFO ("quit");
-  return NULL;
+  priv->eos_posted = TRUE;
+  GST_OBJECT_UNLOCK (sink);
+
+  GST_WARNING_OBJECT (sink, "Posting EOS %lld us after drain",
+      g_get_monotonic_time () - priv->eos_start);
+  message = gst_message_new_eos (GST_OBJECT_CAST (sink));
+  gst_message_set_seqnum (message, priv->seqnum);
+  gst_element_post_message (GST_ELEMENT_CAST (sink), message);
 }
 
-static int start_eos_thread (GstAmlVsink *sink)
+/* display thread, wake up decode thread to post EOS */
+static int display_eos_reached(void *priv_data)
 {
-  GstAmlVsinkPrivate *priv = sink->priv;
+  GstAmlVsinkPrivate *priv = priv_data;
+  uint64_t one = 1;
 
-  priv->eos_wait_thread = g_thread_new ("video eos thread", video_eos_thread, sink);
-  if (!priv->eos_wait_thread) {
-      GST_ERROR_OBJECT (sink, "fail to create thread");
-      return -1;
-  }
+  if (write (priv->eos_fd, &one, sizeof(one)) != sizeof(one))
+    GST_ERROR ("eos notify fail %d", errno);
   return 0;
 }
 
-static int stop_eos_thread (GstAmlVsink *sink)
+/* last frame never showed up, e.g. decoder stalled */
+static void check_eos_timeout(GstAmlVsink *sink)
 {
   GstAmlVsinkPrivate *priv = sink->priv;
 
-  GST_OBJECT_LOCK (sink);
-  priv->quit_eos_wait = TRUE;
-  if (priv->eos_wait_thread) {
-    GST_OBJECT_UNLOCK (sink);
-    g_thread_join (priv->eos_wait_thread);
-    priv->eos_wait_thread = NULL;
-    return 0;
-  }
-  GST_OBJECT_UNLOCK (sink);
-  return 0;
+  if (!priv->received_eos || priv->eos_posted || !priv->eos_start)
+    return;
+  if (g_get_monotonic_time () - priv->eos_start < 30 * G_USEC_PER_SEC)
+    return;
+
+  GST_WARNING_OBJECT (sink, "EOS timeout");
+  post_eos (sink);
 }
 
 static gboolean
@@ -1279,7 +1895,7 @@ gst_aml_vsink_event (GstAmlVsink *sink, GstEvent * event)
       };
 
       priv->received_eos = TRUE;
-      priv->eos = FALSE;
+      set_decoder_eos (priv, FALSE);
       priv->seqnum = gst_event_get_seqnum (event);
       GST_WARNING_OBJECT (sink, "EOS received seqnum %d", priv->seqnum);
 
@@ -1297,7 +1913,14 @@ gst_aml_vsink_event (GstAmlVsink *sink, GstEvent * event)
         break;
       }
 
-      start_eos_thread (sink);
+      priv->eos_posted = FALSE;
+      priv->eos_start = g_get_monotonic_time ();
+      /* no decode thread to wait for display */
+      if (!priv->videoOutputThread) {
+        GST_OBJECT_UNLOCK (sink);
+        post_eos (sink);
+        break;
+      }
       GST_OBJECT_UNLOCK (sink);
       break;
     }
@@ -1309,6 +1932,10 @@ gst_aml_vsink_event (GstAmlVsink *sink, GstEvent * event)
       priv->received_eos = FALSE;
       priv->flushing_ = TRUE;
       GST_OBJECT_UNLOCK (sink);
+      /* streaming thread may wait for gapless drain */
+      g_mutex_lock (&priv->output_buffer_lock);
+      g_cond_signal (&priv->drain_done);
+      g_mutex_unlock (&priv->output_buffer_lock);
       break;
     }
     case GST_EVENT_FLUSH_STOP:
@@ -1319,9 +1946,6 @@ gst_aml_vsink_event (GstAmlVsink *sink, GstEvent * event)
       reset_decoder (sink, true);
       vsink_reset (sink);
       GST_OBJECT_UNLOCK (sink);
-#ifdef DUMP_TO_FILE
-      file_index++;
-#endif
       break;
     }
     case GST_EVENT_SEGMENT:
@@ -1354,6 +1978,7 @@ gst_aml_vsink_event (GstAmlVsink *sink, GstEvent * event)
       gst_event_parse_group_id (event, &group_id);
       GST_DEBUG_OBJECT (sink, "group change from %d to %d",
           priv->group_id, group_id);
+      priv->group_switch = priv->group_done && priv->group_id != group_id;
       priv->group_id = group_id;
       priv->group_done = FALSE;
       GST_DEBUG_OBJECT (sink, "stream start, gid %d", group_id);
@@ -1440,64 +2065,224 @@ static void postErrorMessage(GstAmlVsink *sink, int errorCode, const char *error
   }
 }
 
-static void update_stretch_window(GstAmlVsinkPrivate *priv)
+GType gst_aml_vsink_easing_get_type (void)
 {
-  int32_t x, y, w, h;
-  int64_t cmp_w, cmp_h, delta;
-  struct rect *win;
-
-  if (!priv || priv->stretch_mode == 0)
-    return;
-
-  x = priv->window.x;
-  y = priv->window.y;
-  w = priv->window.w;
-  h = priv->window.h;
+  static gsize type = 0;
+  static const GEnumValue values[] = {
+    { WIN_EASING_LINEAR, "Linear", "linear" },
+    { WIN_EASING_IN, "Ease in", "ease-in" },
+    { WIN_EASING_OUT, "Ease out", "ease-out" },
+    { WIN_EASING_IN_OUT, "Ease in and out", "ease-in-out" },
+    { 0, NULL, NULL }
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType t = g_enum_register_static ("GstAmlVsinkEasing", values);
+    g_once_init_leave (&type, t);
+  }
+  return type;
+}
 
-  if (!w)
-    w = priv->screen_w;
-  if (!h)
-    h = priv->screen_h;
+static gboolean gst_aml_vsink_animate_window (GstAmlVsink *sink, gint x, gint y,
+    gint w, gint h, guint duration, gint easing)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  struct rect *win;
 
-  if (w && h) {
-    cmp_w = (int64_t)priv->visible_w * priv->pixel_w * h;
-    cmp_h = (int64_t)priv->visible_h * priv->pixel_h * w;
+  if (easing < WIN_EASING_LINEAR || easing > WIN_EASING_IN_OUT) {
+    GST_ERROR_OBJECT (sink, "invalid easing %d", easing);
+    return FALSE;
+  }
+  /* plane window is unsigned, no off screen origin */
+  if (x < 0 || y < 0 || w <= 0 || h <= 0) {
+    GST_ERROR_OBJECT (sink, "invalid window (%d,%d,%d,%d)", x, y, w, h);
+    return FALSE;
+  }
 
-    if (cmp_w > cmp_h) {
-      delta = h * cmp_h / cmp_w;
-      y += (h - delta) / 2;
-      h = (int32_t)delta;
-    } else if (cmp_w < cmp_h) {
-      delta = w * cmp_w / cmp_h;
-      x += (w - delta) / 2;
-      w = (int32_t)delta;
-    }
+  GST_OBJECT_LOCK (sink);
+  if (!priv->render) {
+    GST_OBJECT_UNLOCK (sink);
+    GST_WARNING_OBJECT (sink, "animation in NULL state ignored");
+    return FALSE;
   }
 
-  priv->stretch_window.x = x;
-  priv->stretch_window.y = y;
-  priv->stretch_window.w = w;
-  priv->stretch_window.h = h;
+  priv->scale_set = true;
+  priv->window.x = x;
+  priv->window.y = y;
+  priv->window.w = w;
+  priv->window.h = h;
 
-  if (priv->stretch_mode == 0)
-    win = &priv->window;
-  else
+  if (priv->stretch_mode && priv->visible_w && priv->visible_h) {
+    calc_stretch_window (priv);
     win = &priv->stretch_window;
+  } else {
+    win = &priv->window;
+  }
+  display_engine_animate_dst_rect (priv->render, win, duration, easing);
+  priv->dw_reselect = priv->dw_auto;
+  GST_OBJECT_UNLOCK (sink);
 
-  display_engine_set_dst_rect(priv->render, win);
-  GST_DEBUG ("stretch [%d %d %d %d] => [%d %d %d %d]",
-      priv->window.x, priv->window.y,
-      priv->window.w, priv->window.h,
-      x, y, w, h);
+  GST_DEBUG_OBJECT (sink, "animate window to (%d,%d,%d,%d) in %u ms",
+      win->x, win->y, win->w, win->h, duration);
+  return TRUE;
 }
 
-/* return false for retry, true for conitnue processing */
-static bool handle_v4l_event (GstAmlVsink *sink)
+static uint32_t dw_ratio(uint32_t dw_mode)
 {
-  int rc;
-  struct v4l2_event event;
-  GstAmlVsinkPrivate *priv = sink->priv;
-
+  switch (dw_mode) {
+    case VDEC_DW_AFBC_1_4_DW:
+    case VDEC_DW_AFBC_x2_1_4_DW:
+      return 4;
+    case VDEC_DW_AFBC_1_2_DW:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+/* smallest double write that still covers the destination window */
+static uint32_t pick_auto_dw_mode(GstAmlVsinkPrivate *priv)
+{
+  int src_w, src_h, dst_w, dst_h;
+  struct rect *win;
+
+  src_w = priv->visible_w ? priv->visible_w : priv->es_width;
+  src_h = priv->visible_h ? priv->visible_h : priv->es_height;
+  if (src_w <= 0 || src_h <= 0)
+    return VDEC_DW_AFBC_1_4_DW;
+
+  if (priv->stretch_mode && priv->stretch_window.w && priv->stretch_window.h)
+    win = &priv->stretch_window;
+  else
+    win = &priv->window;
+
+  dst_w = win->w;
+  dst_h = win->h;
+  if (!priv->scale_set || !dst_w || !dst_h) {
+    dst_w = priv->screen_w ? priv->screen_w : 1920;
+    dst_h = priv->screen_h ? priv->screen_h : 1080;
+  }
+
+  if (dst_w * 4 <= src_w && dst_h * 4 <= src_h)
+    return VDEC_DW_AFBC_1_4_DW;
+  if (dst_w * 2 <= src_w && dst_h * 2 <= src_h)
+    return VDEC_DW_AFBC_1_2_DW;
+  return VDEC_DW_AFBC_1_1_DW;
+}
+
+/* DDR traffic saved against 1:1 double write, counting decoder
+ * write and display read of each NV12 frame
+ */
+static void report_dw_bandwidth(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  uint32_t ratio = dw_ratio (priv->dw_mode);
+  int w = priv->visible_w ? priv->visible_w : priv->es_width;
+  int h = priv->visible_h ? priv->visible_h : priv->es_height;
+  guint64 full;
+
+  if (w <= 0 || h <= 0 || priv->fr <= 0)
+    return;
+
+  full = (guint64)w * h * 3 / 2 * 2 * priv->fr / 100;
+  priv->dw_bw_saved = full - full / (ratio * ratio);
+  GST_INFO_OBJECT (sink, "auto dw %d for %dx%d in %dx%d window, saves %llu MB/s",
+      priv->dw_mode, w, h, priv->window.w, priv->window.h,
+      priv->dw_bw_saved >> 20);
+}
+
+/* object lock held, buf is a key frame */
+static void reselect_auto_dw(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  uint32_t mode;
+
+  priv->dw_reselect = FALSE;
+  if (priv->afbc_active)
+    return;
+  mode = pick_auto_dw_mode (priv);
+  if (mode == priv->dw_mode)
+    return;
+
+  /* decoder applies new ratio with a resolution change event */
+  if (v4l_dec_dw_config (priv->fd, priv->output_format,
+        mode, priv->low_latency, priv->is_2k_only,
+        priv->fr, &priv->hdr, priv->use_ext_ctrls)) {
+    GST_WARNING_OBJECT (sink, "fail to switch dw %d --> %d", priv->dw_mode, mode);
+    return;
+  }
+  GST_INFO_OBJECT (sink, "switch dw %d --> %d", priv->dw_mode, mode);
+  priv->dw_mode = mode;
+  report_dw_bandwidth (sink);
+}
+
+/* stream can not use AFBC only, go back to linear double write */
+static void afbc_fallback(GstAmlVsink *sink, const char *reason)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  priv->afbc_active = FALSE;
+  priv->dw_mode = priv->dw_auto ? pick_auto_dw_mode (priv) : VDEC_DW_AFBC_1_4_DW;
+  GST_WARNING_OBJECT (sink, "afbc scanout off for %s, dw %d", reason, priv->dw_mode);
+}
+
+/* keep aspect ratio of video inside window */
+static void calc_stretch_window(GstAmlVsinkPrivate *priv)
+{
+  int32_t x, y, w, h;
+  int64_t cmp_w, cmp_h, delta;
+
+  x = priv->window.x;
+  y = priv->window.y;
+  w = priv->window.w;
+  h = priv->window.h;
+
+  if (!w)
+    w = priv->screen_w;
+  if (!h)
+    h = priv->screen_h;
+
+  if (w && h) {
+    cmp_w = (int64_t)priv->visible_w * priv->pixel_w * h;
+    cmp_h = (int64_t)priv->visible_h * priv->pixel_h * w;
+
+    if (cmp_w > cmp_h) {
+      delta = h * cmp_h / cmp_w;
+      y += (h - delta) / 2;
+      h = (int32_t)delta;
+    } else if (cmp_w < cmp_h) {
+      delta = w * cmp_w / cmp_h;
+      x += (w - delta) / 2;
+      w = (int32_t)delta;
+    }
+  }
+
+  priv->stretch_window.x = x;
+  priv->stretch_window.y = y;
+  priv->stretch_window.w = w;
+  priv->stretch_window.h = h;
+  GST_DEBUG ("stretch [%d %d %d %d] => [%d %d %d %d]",
+      priv->window.x, priv->window.y,
+      priv->window.w, priv->window.h,
+      x, y, w, h);
+}
+
+static void update_stretch_window(GstAmlVsinkPrivate *priv)
+{
+  if (!priv || priv->stretch_mode == 0)
+    return;
+
+  calc_stretch_window (priv);
+  display_engine_set_dst_rect(priv->render, &priv->stretch_window);
+}
+
+/* return false for retry, true for conitnue processing */
+static bool handle_v4l_event (GstAmlVsink *sink)
+{
+  int rc;
+  struct v4l2_event event;
+  GstAmlVsinkPrivate *priv = sink->priv;
+
   if (!priv->last_res_frame && priv->out_frame_cnt)
     return true;
 
@@ -1506,7 +2291,9 @@ static bool handle_v4l_event (GstAmlVsink *sink)
 
   rc= ioctl (priv->fd, VIDIOC_DQEVENT, &event);
   if (rc) {
-    GST_ERROR ("fail VIDIOC_DQEVENT %d", errno);
+    /* not raised yet, POLLPRI brings us back */
+    if (errno != EAGAIN)
+      GST_ERROR ("fail VIDIOC_DQEVENT %d", errno);
     goto exit;
   }
 
@@ -1527,6 +2314,9 @@ static bool handle_v4l_event (GstAmlVsink *sink)
     if (fmtIn.fmt.pix_mp.field == V4L2_FIELD_INTERLACED) {
       GST_INFO ("interlaced stream");
       priv->interlaced = TRUE;
+      /* deinterlacer takes linear frames */
+      if (priv->afbc_active)
+        afbc_fallback (sink, "interlaced stream");
     }
 
     memset (&fmtOut, 0, sizeof(fmtOut));
@@ -1549,6 +2339,14 @@ static bool handle_v4l_event (GstAmlVsink *sink)
       priv->coded_w = fmtOut.fmt.pix_mp.width;
       priv->coded_h = fmtOut.fmt.pix_mp.height;
 
+      /* worker posts messages, unlock like stop_decoder does */
+      if (priv->csum) {
+        GST_OBJECT_UNLOCK (sink);
+        frame_checksum_flush (priv->csum);
+        GST_OBJECT_LOCK (sink);
+        if (priv->quitVideoOutputThread)
+          goto exit;
+      }
       pthread_mutex_lock (&priv->res_lock);
       if (priv->capture_port_config) {
         gint rel_num = recycle_capture_port_buffer (priv->fd,
@@ -1660,23 +2458,110 @@ static bool handle_v4l_event (GstAmlVsink *sink)
     }
 
     priv->last_res_frame = FALSE;
+    GST_OBJECT_UNLOCK (sink);
+    /* capture buffer number changed, unlock before post message on bus */
+    update_latency (sink);
+    return false;
   } else if (event.type == V4L2_EVENT_EOS) {
     GST_WARNING_OBJECT (sink, "V4L EOS");
-    pthread_mutex_lock (&priv->res_lock);
-    priv->eos = TRUE;
-    pthread_mutex_unlock (&priv->res_lock);
+    /* wakes the streaming thread if next stream takes over */
+    set_decoder_eos (priv, TRUE);
+    if (!priv->gapless_pending) {
+      /* every decoded frame is pushed, display reports when shown */
+      display_engine_set_eos (priv->render, true);
+    }
   }
 exit:
   GST_OBJECT_UNLOCK (sink);
   return false;
 }
 
-static gpointer dqueue_output_buffer_thread(gpointer data)
+/* non RT threads only: dq_output, or streaming thread in reactor mode.
+ * ioctl is cheap at 1 Hz
+ */
+static void update_dec_cnt(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  struct vdec_cnt cnt;
+  gint64 now = g_get_monotonic_time ();
+
+  if (now < priv->dec_cnt_next)
+    return;
+  priv->dec_cnt_next = now + G_USEC_PER_SEC;
+
+  if (v4l_dec_get_cnt_info (priv->fd, priv->use_ext_ctrls, &cnt))
+    return;
+  g_atomic_int_set (&priv->dec_cnt.bit_rate, cnt.bit_rate);
+  g_atomic_int_set (&priv->dec_cnt.frame_count, cnt.frame_count);
+  g_atomic_int_set (&priv->dec_cnt.error_frame_count, cnt.error_frame_count);
+  g_atomic_int_set (&priv->dec_cnt.drop_frame_count, cnt.drop_frame_count);
+  g_atomic_int_set (&priv->dec_cnt.total_data, cnt.total_data);
+}
+
+/* one OUTPUT buffer back from decoder, wakes streaming thread.
+ * Returns FALSE when none was ready
+ */
+static gboolean reclaim_output_buffer(GstAmlVsink *sink)
 {
   gint rc = -1;
   gint index= -1;
   struct v4l2_buffer buf;
   struct v4l2_plane plane;
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  memset (&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = priv->output_mode;
+  buf.length = 1;
+  buf.m.planes = &plane;
+  GST_OBJECT_LOCK (sink);
+  rc = ioctl (priv->fd, VIDIOC_DQBUF, &buf);
+  if (!rc) {
+    if (priv->ob) {
+      struct output_buffer *ob;
+
+      index = buf.index;
+      ob = priv->ob[index];
+      ob->plane = plane;
+      ob->buf = buf;
+      ob->queued = false;
+      if (ob->gstbuf) {
+        gst_buffer_unref (ob->gstbuf);
+        ob->gstbuf = NULL;
+        priv->ob_unref_num++;
+      }
+      g_mutex_lock(&priv->output_buffer_lock);
+      priv->ob_available_num++;
+      g_mutex_unlock(&priv->output_buffer_lock);
+    } else {
+      GST_WARNING_OBJECT (sink, "priv->ob is NULL");
+    }
+  }
+  GST_OBJECT_UNLOCK (sink);
+
+  g_mutex_lock(&priv->output_buffer_lock);
+  if (priv->ob_available_num > 0) {
+    g_cond_signal (&priv->output_buffer_available);
+  }
+  g_mutex_unlock(&priv->output_buffer_lock);
+  return !rc;
+}
+
+/* context switches of calling thread */
+static void sample_csw(gint *csw, gint64 *next)
+{
+  struct rusage ru;
+  gint64 now = g_get_monotonic_time ();
+
+  if (now < *next)
+    return;
+  *next = now + G_USEC_PER_SEC;
+  if (!getrusage (RUSAGE_THREAD, &ru))
+    g_atomic_int_set (csw, ru.ru_nvcsw + ru.ru_nivcsw);
+}
+
+static gpointer dqueue_output_buffer_thread(gpointer data)
+{
   GstAmlVsink * sink = data;
   GstAmlVsinkPrivate *priv = sink->priv;
 
@@ -1694,6 +2579,8 @@ static gpointer dqueue_output_buffer_thread(gpointer data)
   for (;;) {
     int ret;
     ret = poll (&pfd, 1, 10);
+    update_dec_cnt (sink);
+    sample_csw (&priv->dqout_csw, &priv->dqout_csw_next);
     if (ret > 0)
       break;
     if (priv->quitdqOutputBufferThread)
@@ -1706,42 +2593,12 @@ static gpointer dqueue_output_buffer_thread(gpointer data)
       continue;
     }
 
-    memset (&buf, 0, sizeof(buf));
-    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    buf.memory = priv->output_mode;
-    buf.length = 1;
-    buf.m.planes = &plane;
-    GST_OBJECT_LOCK (sink);
-    rc = ioctl (priv->fd, VIDIOC_DQBUF, &buf);
-    if (!rc) {
-      if (priv->ob) {
-        struct output_buffer *ob;
-
-        index = buf.index;
-        ob = priv->ob[index];
-        ob->plane = plane;
-        ob->buf = buf;
-        ob->queued = false;
-        if (ob->gstbuf) {
-          gst_buffer_unref (ob->gstbuf);
-          ob->gstbuf = NULL;
-          priv->ob_unref_num++;
-        }
-        g_mutex_lock(&priv->output_buffer_lock);
-        priv->ob_available_num++;
-        g_mutex_unlock(&priv->output_buffer_lock);
-      } else {
-        GST_WARNING_OBJECT (sink, "priv->ob is NULL");
-      }
-    }
-    GST_OBJECT_UNLOCK (sink);
-
-    g_mutex_lock(&priv->output_buffer_lock);
-    if (priv->ob_available_num > 0) {
-      g_cond_signal (&priv->output_buffer_available);
-    }
-    g_mutex_unlock(&priv->output_buffer_lock);
+    reclaim_output_buffer (sink);
   }
+  priv->dqout_csw_next = 0;
+  sample_csw (&priv->dqout_csw, &priv->dqout_csw_next);
+  GST_INFO_OBJECT (sink, "quit");
+  return NULL;
 }
 
 static struct capture_buffer* dqueue_capture_buffer(GstAmlVsink * sink)
@@ -1760,7 +2617,11 @@ static struct capture_buffer* dqueue_capture_buffer(GstAmlVsink * sink)
   ret = ioctl (priv->fd, VIDIOC_DQBUF, &buf);
 
   if (ret) {
-    GST_ERROR ("cap VIDIOC_DQBUF fail %d", errno);
+    /* drained, EPIPE once the LAST buffer is out */
+    if (errno == EPIPE)
+      priv->last_res_frame = TRUE;
+    else if (errno != EAGAIN)
+      GST_ERROR ("cap VIDIOC_DQBUF fail %d", errno);
     return NULL;
   } else {
     cb = priv->cb[buf.index];
@@ -1825,6 +2686,131 @@ gboolean detect_audio_sync(GstAmlVsink * sink)
   return found;
 }
 
+/* decode thread, PLAYING may come before avsync was paused */
+static void resume_avsync(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->avsync_paused && !priv->paused) {
+    display_set_pause (priv->render, false);
+    priv->avsync_paused = false;
+  }
+  GST_OBJECT_UNLOCK (sink);
+}
+
+static int reactor_setup(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  struct epoll_event ev = { 0 };
+  int epfd;
+
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    GST_ERROR_OBJECT (sink, "epoll_create1 fail %d", errno);
+    return -1;
+  }
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLPRI;
+  ev.data.fd = priv->fd;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, priv->fd, &ev))
+    goto error;
+  priv->reactor_events = ev.events;
+  priv->reactor_reclaim = FALSE;
+  ev.events = EPOLLIN;
+  ev.data.fd = priv->eos_fd;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, priv->eos_fd, &ev))
+    goto error;
+  ev.data.fd = priv->ctl_fd;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, priv->ctl_fd, &ev))
+    goto error;
+  return epfd;
+
+error:
+  GST_ERROR_OBJECT (sink, "epoll_ctl fail %d", errno);
+  close (epfd);
+  return -1;
+}
+
+static void reactor_wake(GstAmlVsinkPrivate *priv)
+{
+  uint64_t one = 1;
+
+  if (priv->ctl_fd >= 0 && write (priv->ctl_fd, &one, sizeof(one)) < 0)
+    GST_WARNING ("ctl fd write %d", errno);
+}
+
+/* decode thread in reactor mode. EOS, decoder events and capture are
+ * returned in pfd like poll() for the decode loop. Ready OUTPUT buffers
+ * are drained here, the fd is level triggered so a wake that also has
+ * capture leaves them for the next call, after the loop handled capture
+ */
+static void reactor_wait(GstAmlVsink *sink, int epfd, struct pollfd *pfd)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  struct epoll_event ev[3];
+  int i, n;
+
+  for (;;) {
+    uint32_t want;
+
+    /* fd is non-blocking, DQBUF until EAGAIN */
+    if (priv->reactor_reclaim) {
+      while (reclaim_output_buffer (sink))
+        ;
+      priv->reactor_reclaim = FALSE;
+    }
+
+    /* capture stays readable after LAST buffer, wait for the event */
+    want = EPOLLOUT | EPOLLPRI |
+      (priv->last_res_frame ? 0 : EPOLLIN);
+
+    if (want != priv->reactor_events) {
+      struct epoll_event mod = { .events = want, .data.fd = priv->fd };
+
+      if (epoll_ctl (epfd, EPOLL_CTL_MOD, priv->fd, &mod))
+        GST_WARNING_OBJECT (sink, "epoll_ctl mod fail %d", errno);
+      else
+        priv->reactor_events = want;
+    }
+
+    pfd[0].revents = 0;
+    pfd[1].revents = 0;
+    n = epoll_wait (epfd, ev, G_N_ELEMENTS (ev), REACTOR_IDLE_MS);
+    post_stats (sink);
+    sample_csw (&priv->dec_csw, &priv->dec_csw_next);
+    if (priv->quitVideoOutputThread)
+      return;
+    if (n <= 0) {
+      if (n < 0 && errno != EINTR)
+        GST_WARNING_OBJECT (sink, "epoll_wait fail %d", errno);
+      check_eos_timeout (sink);
+      resume_avsync (sink);
+      continue;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (ev[i].data.fd == priv->fd) {
+        pfd[0].revents = ev[i].events;
+      } else if (ev[i].data.fd == priv->eos_fd) {
+        pfd[1].revents = POLLIN;
+      } else {
+        uint64_t cnt;
+
+        if (read (priv->ctl_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+          GST_WARNING_OBJECT (sink, "ctl fd read %d", errno);
+      }
+    }
+
+    if (pfd[0].revents & (POLLOUT | POLLWRNORM))
+      priv->reactor_reclaim = TRUE;
+    if (pfd[1].revents || (pfd[0].revents & (POLLIN | POLLRDNORM | POLLPRI)))
+      return;
+    if (!priv->reactor_reclaim && pfd[0].revents)
+      /* error only, queue not streaming yet */
+      usleep (1000);
+  }
+}
+
 static gpointer video_decode_thread(gpointer data)
 {
   int rc;
@@ -1832,6 +2818,8 @@ static gpointer video_decode_thread(gpointer data)
   GstAmlVsinkPrivate *priv = sink->priv;
   uint32_t type;
   struct sched_param schedParam;
+  int epfd = -1;
+  int fl = -1;
 
   prctl (PR_SET_NAME, "aml_v_dec");
   GST_INFO_OBJECT (sink, "enter");
@@ -1844,12 +2832,18 @@ static gpointer video_decode_thread(gpointer data)
     else
       GST_INFO ("no amlhalasink in pipeline");
 
-    rc = display_start_avsync (priv->render,
-            priv->avsync_mode,
-            priv->sessionId, priv->delay);
-    if (rc) {
-      GST_ERROR ("start avsync error");
-      goto exit;
+    if (priv->keep_display) {
+      /* gapless switch, frames of last stream still queued */
+      GST_INFO_OBJECT (sink, "keep avsync of last stream");
+      priv->keep_display = FALSE;
+    } else {
+      rc = display_start_avsync (priv->render,
+              priv->avsync_mode,
+              priv->sessionId, priv->delay);
+      if (rc) {
+        GST_ERROR ("start avsync error");
+        goto exit;
+      }
     }
   }
 
@@ -1857,37 +2851,69 @@ static gpointer video_decode_thread(gpointer data)
   if (pthread_setschedparam (pthread_self(), SCHED_FIFO, &schedParam))
     GST_WARNING ("fail to set video_decode_thread priority");
 
+  /* DQBUF until EAGAIN, source change event is picked up by POLLPRI */
+  fl = fcntl (priv->fd, F_GETFL);
+  if (fl < 0 || fcntl (priv->fd, F_SETFL, fl | O_NONBLOCK))
+    GST_WARNING_OBJECT (sink, "set O_NONBLOCK fail %d", errno);
+
+  if (priv->reactor_active) {
+    epfd = reactor_setup (sink);
+    if (epfd < 0)
+      goto exit;
+  }
+
   while (!priv->quitVideoOutputThread) {
     gint64 frame_ts;
-    struct capture_buffer *cb;
+    struct capture_buffer *cb, *last;
+    struct capture_buffer *batch[CAPTURE_BATCH_MAX];
+    struct drm_frame *frames[CAPTURE_BATCH_MAX];
     struct rect src_win;
-    struct pollfd pfd = {
-        /* default blocking capture */
-        .events =  POLLIN | POLLRDNORM | POLLPRI,
+    int i, nb, got;
+    struct pollfd pfd[2] = {
+      {
+        /* capture stays readable after LAST buffer, wait for the event */
+        .events = priv->last_res_frame ? POLLPRI : (POLLIN | POLLRDNORM | POLLPRI),
         .fd = priv->fd,
         .revents= 0,
+      },
+      {
+        /* last frame on screen */
+        .events = POLLIN,
+        .fd = priv->eos_fd,
+        .revents = 0,
+      },
     };
 
-    for (;;) {
-      int ret;
+    if (priv->reactor_active) {
+      reactor_wait (sink, epfd, pfd);
+    } else {
+      for (;;) {
+        int ret;
+
+        ret = poll (pfd, 2, 10);
+        post_stats (sink);
+        sample_csw (&priv->dec_csw, &priv->dec_csw_next);
+        if (ret > 0)
+          break;
+        if (priv->quitVideoOutputThread)
+          break;
+        check_eos_timeout (sink);
+        resume_avsync (sink);
+        if (errno == EINTR)
+          continue;
+      }
+    }
 
-      ret = poll (&pfd, 1, 10);
-      if (ret > 0)
-        break;
-      if (priv->quitVideoOutputThread)
-        break;
+    if (pfd[1].revents & POLLIN) {
+      uint64_t cnt;
 
-      GST_OBJECT_LOCK (sink);
-      if (priv->avsync_paused && !priv->paused) {
-        display_set_pause (priv->render, false);
-        priv->avsync_paused = false;
-      }
-      GST_OBJECT_UNLOCK (sink);
-      if (errno == EINTR)
+      if (read (priv->eos_fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+        post_eos (sink);
+      if (!pfd[0].revents)
         continue;
     }
 
-    if (pfd.revents & POLLPRI) {
+    if (pfd[0].revents & POLLPRI) {
       if (!handle_v4l_event (sink))
         continue;
     }
@@ -1897,7 +2923,7 @@ static gpointer video_decode_thread(gpointer data)
     }
 
     /* only handle capture port */
-    if ((pfd.revents & (POLLIN|POLLRDNORM)) == 0) {
+    if ((pfd[0].revents & (POLLIN|POLLRDNORM)) == 0) {
       usleep(1000);
       continue;
     }
@@ -1907,89 +2933,168 @@ static gpointer video_decode_thread(gpointer data)
       continue;
     }
 
-    cb = dqueue_capture_buffer (sink);
-    if (!cb) {
-      GST_WARNING_OBJECT (sink, "capture buf not available");
+    /* DQBUF only returns EPIPE until source change is handled */
+    if (priv->last_res_frame)
       continue;
-    }
 
-    if (cb->buf.flags & V4L2_BUF_FLAG_LAST) {
-      priv->last_res_frame = TRUE;
-      GST_WARNING_OBJECT (sink, "get last frame");
-      handle_v4l_event (sink);
-      continue;
-    }
+    /* everything decoded so far, fd is non-blocking */
+    nb = 0;
+    last = NULL;
+    got = 0;
+    while (nb < CAPTURE_BATCH_MAX) {
+      cb = dqueue_capture_buffer (sink);
+      if (!cb)
+        break;
+      got++;
 
-    g_atomic_int_add (&priv->buf_dec_num, -1);
+      if (cb->buf.flags & V4L2_BUF_FLAG_LAST) {
+        last = cb;
+        break;
+      }
 
-    frame_ts = GST_TIMEVAL_TO_TIME(cb->buf.timestamp);
-    if (frame_ts < priv->segment.start ||
-        (priv->start_pts != GST_CLOCK_TIME_NONE && frame_ts < priv->start_pts)) {
-      GST_INFO ("drop frame %lld before seg start %lld start pts %lld",
-          frame_ts, priv->segment.start, priv->start_pts);
-      pthread_mutex_lock (&priv->res_lock);
-      v4l_queue_capture_buffer (priv->fd, cb);
-      g_atomic_int_inc (&priv->buf_dec_num);
-      pthread_mutex_unlock (&priv->res_lock);
+      g_atomic_int_add (&priv->buf_dec_num, -1);
+
+      frame_ts = GST_TIMEVAL_TO_TIME(cb->buf.timestamp);
+      if (frame_ts < priv->segment.start ||
+          (priv->start_pts != GST_CLOCK_TIME_NONE && frame_ts < priv->start_pts)) {
+        GST_INFO ("drop frame %lld before seg start %lld start pts %lld",
+            frame_ts, priv->segment.start, priv->start_pts);
+        pthread_mutex_lock (&priv->res_lock);
+        v4l_queue_capture_buffer (priv->fd, cb);
+        g_atomic_int_inc (&priv->buf_dec_num);
+        pthread_mutex_unlock (&priv->res_lock);
+        continue;
+      }
+      batch[nb++] = cb;
+    }
+    if (!got) {
+      if (!priv->last_res_frame)
+        GST_WARNING_OBJECT (sink, "capture buf not available");
       continue;
     }
 
-    /* pause logic after start segment check*/
-    GST_OBJECT_LOCK (sink);
-    if (!priv->avsync_paused && priv->paused) {
-      display_set_pause (priv->render, true);
-      priv->avsync_paused = true;
-    }
-    GST_OBJECT_UNLOCK (sink);
+    for (i = 0; i < nb; i++) {
+      cb = batch[i];
+      frame_ts = GST_TIMEVAL_TO_TIME(cb->buf.timestamp);
+
+      if (priv->out_frame_cnt == 0 && !priv->flushing_) {
+        log_info("vsink rendering first ts %lld", frame_ts);
+        GST_WARNING_OBJECT (sink, "emit first frame signal ts %lld", frame_ts);
+        g_signal_emit (G_OBJECT (sink), g_signals[SIGNAL_FIRSTFRAME], 0, 2, NULL);
+        GST_WARNING_OBJECT (sink, "emit first frame signal ts %lld done", frame_ts);
+        if (priv->zap_start) {
+          log_info("vsink zap time %lld us", g_get_monotonic_time () - priv->zap_start);
+          GST_WARNING_OBJECT (sink, "zap time %lld us",
+              g_get_monotonic_time () - priv->zap_start);
+          priv->zap_start = 0;
+        }
 
-    if (priv->out_frame_cnt == 0 && !priv->flushing_) {
-      log_info("vsink rendering first ts %lld", frame_ts);
-      GST_WARNING_OBJECT (sink, "emit first frame signal ts %lld", frame_ts);
-      g_signal_emit (G_OBJECT (sink), g_signals[SIGNAL_FIRSTFRAME], 0, 2, NULL);
-      GST_WARNING_OBJECT (sink, "emit first frame signal ts %lld done", frame_ts);
+        priv->start_pts = GST_CLOCK_TIME_NONE;
+      }
 
-      priv->start_pts = GST_CLOCK_TIME_NONE;
+      priv->out_frame_cnt++;
+
+      /* caps framerate can be missing or wrong, trust timestamps once
+       * cadence is known
+       */
+      cadence_push (&priv->cadence, frame_ts);
+      cb->drm_frame->duration = cadence_duration_90k (&priv->cadence);
+      if (!cb->drm_frame->duration && priv->fr)
+        cb->drm_frame->duration = 90000 * 100/priv->fr;
+
+      cb->drm_frame->pri_dec = cb;
+      cb->drm_frame->pts = gst_util_uint64_scale_int (frame_ts, PTS_90K, GST_SECOND);
+      cb->drm_frame->timestamp = frame_ts;
+
+      cb->displayed = true;
+      /* worker reads the frame while it is on screen, requeue waits for it */
+      if (priv->csum && !priv->secure && !priv->afbc_active) {
+        struct csum_plane pl[2] = {
+          { cb->gem_fd[0], cb->stride[0], cb->offset[0], cb->size[0] },
+          { cb->gem_fd[1] > 0 ? cb->gem_fd[1] : cb->gem_fd[0],
+            cb->stride[1], cb->offset[1], cb->size[1] },
+        };
+
+        __atomic_store_n (&cb->csum_busy, 1, __ATOMIC_RELEASE);
+        if (frame_checksum_submit (priv->csum, cb, pl,
+              priv->visible_dw_w, priv->visible_dw_h, frame_ts))
+          __atomic_store_n (&cb->csum_busy, 0, __ATOMIC_RELEASE);
+      }
+      frames[i] = cb->drm_frame;
     }
 
-    priv->out_frame_cnt++;
+    if (nb) {
+      int shown = 0;
 
-    if (priv->fr)
-      cb->drm_frame->duration = 90000 * 100/priv->fr;
-    else
-      cb->drm_frame->duration = 0;
+      /* pause logic after start segment check*/
+      GST_OBJECT_LOCK (sink);
+      if (!priv->avsync_paused && priv->paused) {
+        display_set_pause (priv->render, true);
+        priv->avsync_paused = true;
+      }
 
-    cb->drm_frame->pri_dec = cb;
-    cb->drm_frame->pts = gst_util_uint64_scale_int (frame_ts, PTS_90K, GST_SECOND);
+      if (priv->src_rec_set) {
+        src_win.x = priv->visible_dw_w * priv->source_window.x;
+        src_win.y = priv->visible_dw_h * priv->source_window.y;
+        src_win.w = priv->visible_dw_w * priv->source_window.w;
+        src_win.h = priv->visible_dw_h * priv->source_window.h;
 
-    cb->displayed = true;
-    GST_OBJECT_LOCK (sink);
-    if (priv->src_rec_set) {
-      src_win.x = priv->visible_dw_w * priv->source_window.x;
-      src_win.y = priv->visible_dw_h * priv->source_window.y;
-      src_win.w = priv->visible_dw_w * priv->source_window.w;
-      src_win.h = priv->visible_dw_h * priv->source_window.h;
+      } else {
+        src_win.x = 0;
+        src_win.y = 0;
+        src_win.w = priv->visible_dw_w;
+        src_win.h = priv->visible_dw_h;
+      }
 
-    } else {
-      src_win.x = 0;
-      src_win.y = 0;
-      src_win.w = priv->visible_dw_w;
-      src_win.h = priv->visible_dw_h;
-    }
+      if (priv->render) {
+        shown = display_engine_show_batch (priv->render, frames, nb, &src_win);
+        if (shown < 0)
+          shown = 0;
+        g_atomic_int_add (&priv->buf_dis_num, shown);
+        GST_LOG_OBJECT (sink, "%d of %d frames to display", shown, nb);
+      }
+      GST_OBJECT_UNLOCK (sink);
 
-    if (priv->render) {
-      rc = display_engine_show (priv->render, cb->drm_frame, &src_win);
-      if (rc) {
-        GST_WARNING_OBJECT (sink, "show %d error %d", cb->id, rc);
-      } else {
-        GST_LOG_OBJECT (sink, "cb index %d to display", cb->id);
-        g_atomic_int_inc (&priv->buf_dis_num);
+      /* rejected frames never reach recycle, give them back here.
+       * Already counted as output, account them as dropped
+       */
+      for (i = shown; i < nb; i++) {
+        cb = batch[i];
+        GST_WARNING_OBJECT (sink, "show %d error", cb->id);
+        cb->displayed = false;
+        g_atomic_int_inc (&priv->dropped_frame_num);
+        pthread_mutex_lock (&priv->res_lock);
+        if (__atomic_load_n (&cb->csum_busy, __ATOMIC_ACQUIRE))
+          cb->requeue_deferred = true;
+        else
+          release_capture_buffer (priv, cb);
+        pthread_mutex_unlock (&priv->res_lock);
       }
+      g_atomic_int_inc (&priv->capture_batches);
+
+      /* follow measured vblank period */
+      update_latency (sink);
+    }
+
+    if (last) {
+      priv->last_res_frame = TRUE;
+      GST_WARNING_OBJECT (sink, "get last frame");
+      handle_v4l_event (sink);
     }
-    GST_OBJECT_UNLOCK (sink);
   }
 
 exit:
-  display_stop_avsync (priv->render);
+  if (fl >= 0)
+    fcntl (priv->fd, F_SETFL, fl);
+  if (epfd >= 0)
+    close (epfd);
+  priv->dec_csw_next = 0;
+  sample_csw (&priv->dec_csw, &priv->dec_csw_next);
+  GST_INFO_OBJECT (sink, "context switches %d for %d frames, reactor %d",
+      g_atomic_int_get (&priv->dec_csw) + g_atomic_int_get (&priv->dqout_csw),
+      priv->out_frame_cnt, priv->reactor_active);
+  if (!priv->keep_display)
+    display_stop_avsync (priv->render);
   /* stop output port */
   type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
   rc = ioctl (priv->fd, VIDIOC_STREAMOFF, &type);
@@ -2018,6 +3123,12 @@ static int start_video_thread (GstAmlVsink * sink)
   priv->quitVideoOutputThread = FALSE;
   priv->quitdqOutputBufferThread = FALSE;
   if (!priv->videoOutputThread) {
+    priv->reactor_active = priv->reactor;
+    priv->dec_csw = 0;
+    priv->dqout_csw = 0;
+    priv->dec_csw_next = 0;
+    priv->dqout_csw_next = 0;
+    priv->capture_batches = 0;
     GST_DEBUG_OBJECT (sink, "starting video thread");
     priv->videoOutputThread = g_thread_new ("video output thread", video_decode_thread, sink);
     if (!priv->videoOutputThread) {
@@ -2026,7 +3137,8 @@ static int start_video_thread (GstAmlVsink * sink)
     }
   }
 
-  if (!priv->dqOutputBufferThread) {
+  /* reactor reclaims OUTPUT buffers itself */
+  if (!priv->dqOutputBufferThread && !priv->reactor_active) {
     GST_DEBUG_OBJECT (sink, "starting dq_output thread");
     priv->dqOutputBufferThread = g_thread_new ("dq_output thread", dqueue_output_buffer_thread, sink);
     if (!priv->dqOutputBufferThread) {
@@ -2061,6 +3173,21 @@ static int get_output_buffer(GstAmlVsink * sink)
   return index;
 }
 
+static void fill_dec_cfg(GstAmlVsinkPrivate *priv, struct dec_cfg *cfg)
+{
+  memset (cfg, 0, sizeof(*cfg));
+  cfg->format = priv->output_format;
+  cfg->width = priv->es_width;
+  cfg->height = priv->es_height;
+  cfg->dw_mode = priv->dw_mode;
+  cfg->secure = priv->secure;
+  cfg->low_latency = priv->low_latency;
+  cfg->only_2k = priv->is_2k_only;
+  cfg->ext_ctrls = priv->use_ext_ctrls;
+  cfg->frame_rate = priv->fr;
+  memcpy (&cfg->hdr, &priv->hdr, sizeof(cfg->hdr));
+}
+
 static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
 {
   GstAmlVsinkPrivate *priv = sink->priv;
@@ -2069,9 +3196,13 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
   int index;
   int rc;
   struct output_buffer *ob;
+  gchar *dump_location = NULL;
   GstFlowReturn ret = GST_FLOW_OK;
 
   mem = gst_buffer_peek_memory (buf, 0);
+  if (G_UNLIKELY (priv->gapless_pending))
+    gapless_handover (sink, gst_is_dmabuf_memory (mem));
+
   if (!priv->output_port_config) {
     if (gst_is_dmabuf_memory (mem))
       priv->output_mode = V4L2_MEMORY_DMABUF;
@@ -2084,32 +3215,52 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
       goto unlock_exit;
     }
     priv->secure = (priv->output_mode == V4L2_MEMORY_DMABUF);
-    rc = v4l_set_secure_mode (priv->fd, priv->es_width,
-        priv->es_height, priv->secure);
-    if (rc) {
-      GST_ERROR_OBJECT (sink, "set secure mode fail");
-      ret = GST_FLOW_ERROR;
-      goto unlock_exit;
+    /* AFBC buffer can not be allocated from protected heap */
+    if (priv->secure && priv->afbc_active)
+      afbc_fallback (sink, "secure stream");
+
+    if (priv->decoder_pool) {
+      struct dec_cfg cfg;
+
+      fill_dec_cfg (priv, &cfg);
+      if (priv->pool_cfg.format && dec_cfg_equal (&cfg, &priv->pool_cfg))
+        priv->out_preconfigured = TRUE;
+      /* fd reopened by flush is not configured */
+      memset (&priv->pool_cfg, 0, sizeof(priv->pool_cfg));
+      dec_pool_update (&cfg);
     }
 
-    /* Need to set correct dw mode even before first frame.
-     * Restrict apply that dw 16 can not be changed to other mode
-     * in the run time, but dw 0/1/2/4 can be changed in runtime */
-    if (v4l_dec_dw_config (priv->fd, priv->output_format,
-              priv->dw_mode,priv->low_latency, priv->is_2k_only,
-              priv->fr, &priv->hdr, priv->use_ext_ctrls)) {
-      GST_ERROR("v4l_dec_dw_config failed");
-      ret = GST_FLOW_ERROR;
-      goto unlock_exit;
-    }
+    if (priv->out_preconfigured) {
+      GST_INFO_OBJECT (sink, "output port preconfigured");
+    } else {
+      rc = v4l_set_secure_mode (priv->fd, priv->es_width,
+          priv->es_height, priv->secure);
+      if (rc) {
+        GST_ERROR_OBJECT (sink, "set secure mode fail");
+        ret = GST_FLOW_ERROR;
+        goto unlock_exit;
+      }
 
-    rc = v4l_set_output_format (priv->fd, priv->output_format,
-        priv->es_width, priv->es_height, priv->is_2k_only);
-    if (rc) {
-      GST_ERROR_OBJECT (sink, "set output format %x fail", priv->output_format);
-      ret = GST_FLOW_ERROR;
-      goto unlock_exit;
+      /* Need to set correct dw mode even before first frame.
+       * Restrict apply that dw 16 can not be changed to other mode
+       * in the run time, but dw 0/1/2/4 can be changed in runtime */
+      if (v4l_dec_dw_config (priv->fd, priv->output_format,
+                priv->dw_mode,priv->low_latency, priv->is_2k_only,
+                priv->fr, &priv->hdr, priv->use_ext_ctrls)) {
+        GST_ERROR("v4l_dec_dw_config failed");
+        ret = GST_FLOW_ERROR;
+        goto unlock_exit;
+      }
+
+      rc = v4l_set_output_format (priv->fd, priv->output_format,
+          priv->es_width, priv->es_height, priv->is_2k_only);
+      if (rc) {
+        GST_ERROR_OBJECT (sink, "set output format %x fail", priv->output_format);
+        ret = GST_FLOW_ERROR;
+        goto unlock_exit;
+      }
     }
+    priv->out_preconfigured = FALSE;
 
     priv->ob = v4l_setup_output_port (priv->fd, priv->output_mode, &priv->ob_num);
     if (!priv->ob) {
@@ -2121,7 +3272,23 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
     priv->ob_available_num = priv->ob_num;
     g_mutex_unlock(&priv->output_buffer_lock);
     priv->output_port_config = TRUE;
+
+    /* secure input can not be read */
+    if (priv->es_dump_location && !priv->es_dump &&
+        priv->output_mode == V4L2_MEMORY_MMAP)
+      dump_location = g_strdup (priv->es_dump_location);
     GST_OBJECT_UNLOCK (sink);
+
+    /* creates files and writer thread, keep it off the object lock */
+    if (dump_location) {
+      struct es_dump *d = es_dump_open (dump_location,
+          priv->output_format, priv->es_width, priv->es_height);
+
+      g_free (dump_location);
+      GST_OBJECT_LOCK (sink);
+      priv->es_dump = d;
+      GST_OBJECT_UNLOCK (sink);
+    }
   }
 
   if (GST_BUFFER_PTS_IS_VALID(buf)) {
@@ -2157,6 +3324,16 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
   }
   ob = priv->ob[index];
   priv->in_frame_cnt++;
+  /* no dq_output thread and decode thread is RT */
+  if (priv->reactor_active)
+    update_dec_cnt (sink);
+
+  if (priv->dw_reselect &&
+      !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    reselect_auto_dw (sink);
+  if (priv->caps_meta_pending &&
+      !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    caps_meta_apply (sink);
 
   if (priv->output_mode == V4L2_MEMORY_DMABUF) {
     gsize dataOffset, maxSize;
@@ -2218,11 +3395,16 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
         goto unlock_exit;
       }
 
-      if (priv->codec_data && !priv->codec_data_injected) {
+      /* new codec data goes with next IDR */
+      if (priv->codec_data && !priv->codec_data_injected &&
+          !priv->caps_meta_pending) {
         GST_DEBUG_OBJECT (sink, "injecting %d bytes codec data", priv->codec_data_len);
         memcpy (ob->vaddr, priv->codec_data, priv->codec_data_len);
         ob->vaddr += priv->codec_data_len;
         priv->codec_data_injected = TRUE;
+        if (priv->es_dump)
+          es_dump_push (priv->es_dump, priv->codec_data, priv->codec_data_len,
+              GST_BUFFER_PTS(buf), ES_DUMP_CODEC_DATA);
         copied += priv->codec_data_len;
       }
 
@@ -2256,16 +3438,10 @@ static GstFlowReturn decode_buf (GstAmlVsink * sink, GstBuffer * buf)
               ob->buf.index, copied, GST_BUFFER_PTS(buf),
               priv->in_frame_cnt, priv->out_frame_cnt);
       }
-#ifdef DUMP_TO_FILE
-      if (getenv("AML_VSINK_ES_DUMP")) {
-        uint32_t pts32;
-        pts32 = gst_util_uint64_scale_int (GST_BUFFER_PTS(buf), PTS_90K, GST_SECOND);
-        dump ("/tmp/amlvsink", inData, copied,
-            priv->output_format == V4L2_PIX_FMT_VP9,
-            priv->in_frame_cnt);
-        GST_INFO ("dump len %d ts %x", copied, pts32);
-      }
-#endif
+      if (priv->es_dump)
+        es_dump_push (priv->es_dump, inData, copylen, GST_BUFFER_PTS(buf),
+            GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) ?
+            0 : ES_DUMP_KEY);
     }
     gst_buffer_unmap (buf, &map);
   }
@@ -2357,47 +3533,153 @@ gst_aml_vsink_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
   return gst_aml_vsink_render (sink, buf);
 }
 
-static GstStateChangeReturn ready_to_pause(GstAmlVsink *sink)
+/* open decoder, query port formats and subscribe events */
+static int open_decoder(struct v4l2_fmtdesc **out_formats,
+    struct v4l2_fmtdesc **cap_formats)
 {
-  GstStateChangeReturn ret = GST_STATE_CHANGE_FAILURE;
-  GstAmlVsinkPrivate *priv = sink->priv;
   int fd;
   uint32_t fnum;
-  struct v4l2_fmtdesc *formats = NULL;
-  int rc;
+
+  *out_formats = NULL;
+  *cap_formats = NULL;
 
   fd = v4l_dec_open (true);
   if (fd < 0) {
     GST_ERROR("dec open fail");
-    goto error;
+    return -1;
   }
 
   /* output port formats */
-  formats = v4l_get_output_port_formats (fd, &fnum);
-  if (!formats)
+  *out_formats = v4l_get_output_port_formats (fd, &fnum);
+  if (!*out_formats)
     goto error;
 
-  priv->output_formats = formats;
-
   /* capture port formats */
-  formats = v4l_get_capture_port_formats (fd, &fnum);
-  if (!formats) {
+  *cap_formats = v4l_get_capture_port_formats (fd, &fnum);
+  if (!*cap_formats) {
     GST_ERROR("get capture format fail");
     goto error;
   }
 
-  priv->capture_formats = formats;
-
-  rc = v4l_reg_event(fd);
-  if (rc) {
+  if (v4l_reg_event(fd)) {
     GST_ERROR("reg event fail");
     goto error;
   }
+  return fd;
+
+error:
+  close (fd);
+  g_free (*out_formats);
+  g_free (*cap_formats);
+  *out_formats = NULL;
+  *cap_formats = NULL;
+  return -1;
+}
+
+static gpointer prewarm_thread(gpointer data)
+{
+  GstAmlVsink *sink = data;
+  GstAmlVsinkPrivate *priv = sink->priv;
+  gint64 start = g_get_monotonic_time ();
+
+  prctl (PR_SET_NAME, "aml_prewarm_t");
+  priv->prewarm_render = display_engine_start (priv, priv->prewarm_pip,
+      priv->prewarm_ll, priv->prewarm_shared);
+  priv->prewarm_fd = open_decoder (&priv->prewarm_out_formats,
+      &priv->prewarm_cap_formats);
+  GST_INFO_OBJECT (sink, "prewarm done in %lld us render %p fd %d",
+      g_get_monotonic_time () - start, priv->prewarm_render, priv->prewarm_fd);
+  return NULL;
+}
+
+/* NULL state only */
+static void prewarm_start(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->prewarm_thread || priv->render || priv->fd >= 0) {
+    GST_OBJECT_UNLOCK (sink);
+    return;
+  }
+  prewarm_release (priv);
+  priv->prewarm_pip = priv->pip;
+  priv->prewarm_ll = priv->low_latency;
+  priv->prewarm_shared = priv->shared_display;
+  priv->prewarm_thread = g_thread_new ("aml_prewarm_t", prewarm_thread, sink);
+  GST_OBJECT_UNLOCK (sink);
+}
+
+/* state change waits here only if prewarm is still running */
+static void prewarm_join(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  gint64 start;
+
+  if (!priv->prewarm_thread)
+    return;
+
+  start = g_get_monotonic_time ();
+  g_thread_join (priv->prewarm_thread);
+  priv->prewarm_thread = NULL;
+  GST_INFO_OBJECT (sink, "waited %lld us for prewarm",
+      g_get_monotonic_time () - start);
+}
+
+/* free what was not taken by state change */
+static void prewarm_release(GstAmlVsinkPrivate *priv)
+{
+  if (priv->prewarm_render) {
+    display_engine_stop (priv->prewarm_render);
+    priv->prewarm_render = NULL;
+  }
+  if (priv->prewarm_fd >= 0) {
+    v4l_unreg_event (priv->prewarm_fd);
+    close (priv->prewarm_fd);
+    priv->prewarm_fd = -1;
+  }
+  g_free (priv->prewarm_out_formats);
+  g_free (priv->prewarm_cap_formats);
+  priv->prewarm_out_formats = NULL;
+  priv->prewarm_cap_formats = NULL;
+}
+
+static GstStateChangeReturn ready_to_pause(GstAmlVsink *sink)
+{
+  GstStateChangeReturn ret = GST_STATE_CHANGE_FAILURE;
+  GstAmlVsinkPrivate *priv = sink->priv;
+  int fd;
+
+  priv->zap_start = g_get_monotonic_time ();
+  memset (&priv->pool_cfg, 0, sizeof(priv->pool_cfg));
+  if (priv->prewarm_fd >= 0) {
+    fd = priv->prewarm_fd;
+    priv->output_formats = priv->prewarm_out_formats;
+    priv->capture_formats = priv->prewarm_cap_formats;
+    priv->prewarm_fd = -1;
+    priv->prewarm_out_formats = NULL;
+    priv->prewarm_cap_formats = NULL;
+    GST_INFO_OBJECT (sink, "use prewarmed decoder");
+  } else if (priv->decoder_pool &&
+      (fd = dec_pool_get (&priv->pool_cfg)) >= 0) {
+    GST_INFO_OBJECT (sink, "use standby decoder %d fmt %x", fd,
+        priv->pool_cfg.format);
+  } else {
+    fd = open_decoder (&priv->output_formats, &priv->capture_formats);
+    if (fd < 0)
+      goto error;
+  }
 
   priv->fd = fd;
-#ifdef DUMP_TO_FILE
-  file_index++;
-#endif
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->frame_checksum) {
+    bool bus = !strcmp (priv->frame_checksum, "bus");
+
+    priv->csum = frame_checksum_start (bus ? NULL : priv->frame_checksum,
+        checksum_result, checksum_done, sink);
+  }
+  GST_OBJECT_UNLOCK (sink);
 
   if (priv->pause_pts != -1) {
     display_set_pause_pts (priv->render, priv->pause_pts);
@@ -2406,30 +3688,20 @@ static GstStateChangeReturn ready_to_pause(GstAmlVsink *sink)
 
   display_set_checkunderflow(priv->render, priv->is_underflow_check);
   if (priv->is_underflow_check)
-    display_underflow_register_cb(buffer_underflow_happened);
+    display_underflow_register_cb(priv->render, buffer_underflow_happened);
   else
-    display_underflow_register_cb(NULL);
+    display_underflow_register_cb(priv->render, NULL);
 
   priv->paused = TRUE;
   priv->avsync_paused = FALSE;
-  priv->quit_eos_wait = FALSE;
 
   return GST_STATE_CHANGE_SUCCESS;
 error:
-  if (fd >= 0 )
-    close( fd );
-
-  if (priv->output_formats)
-    g_free (priv->output_formats);
-
-  if (priv->capture_formats)
-    g_free (priv->capture_formats);
-
   return ret;
-
 }
 
-static void reset_decoder(GstAmlVsink *sink, bool hard)
+/* stop threads and release both ports, fd stays open */
+static void stop_decoder(GstAmlVsink *sink)
 {
   int ret;
   uint32_t type;
@@ -2439,9 +3711,12 @@ static void reset_decoder(GstAmlVsink *sink, bool hard)
   priv->quitVideoOutputThread = TRUE;
   priv->quitdqOutputBufferThread = TRUE;
 
+  reactor_wake (priv);
+
   /* signal output_buffer_available in case wait in get_output_buffer*/
   g_mutex_lock(&priv->output_buffer_lock);
   g_cond_signal (&priv->output_buffer_available);
+  g_cond_signal (&priv->drain_done);
   g_mutex_unlock(&priv->output_buffer_lock);
 
   /* stop output port */
@@ -2480,6 +3755,15 @@ static void reset_decoder(GstAmlVsink *sink, bool hard)
     priv->dqOutputBufferThread = NULL;
   }
 
+  /* worker must be off the capture buffers before they go, it posts
+   * messages so it needs the object lock
+   */
+  if (priv->csum) {
+    GST_OBJECT_UNLOCK (sink);
+    frame_checksum_flush (priv->csum);
+    GST_OBJECT_LOCK (sink);
+  }
+
   pthread_mutex_lock (&priv->res_lock);
   if (priv->capture_port_config) {
     gint rel_num = recycle_capture_port_buffer (priv->fd,
@@ -2491,6 +3775,33 @@ static void reset_decoder(GstAmlVsink *sink, bool hard)
     g_atomic_int_add (&priv->buf_dec_num, -rel_num);
   }
   pthread_mutex_unlock (&priv->res_lock);
+  priv->last_res_frame = FALSE;
+
+  /* one dump session per decoder configuration, closing flushes
+   * the ring to file so drop the object lock for it
+   */
+  if (priv->es_dump) {
+    struct es_dump *d = priv->es_dump;
+
+    priv->es_dump = NULL;
+    GST_OBJECT_UNLOCK (sink);
+    es_dump_close (d);
+    GST_OBJECT_LOCK (sink);
+  }
+}
+
+/* stop decoding and optionally reopen the node, stream config kept */
+static void restart_decoder(GstAmlVsink *sink, bool hard)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  stop_decoder (sink);
+
+  /* decoder switched but next stream never started */
+  if (priv->keep_display) {
+    display_stop_avsync (priv->render);
+    priv->keep_display = FALSE;
+  }
 
   if (hard) {
     pthread_mutex_lock (&priv->res_lock);
@@ -2505,16 +3816,194 @@ static void reset_decoder(GstAmlVsink *sink, bool hard)
     }
     pthread_mutex_unlock (&priv->res_lock);
   }
-  priv->last_res_frame = FALSE;
+}
+
+static void reset_decoder(GstAmlVsink *sink, bool hard)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  restart_decoder (sink, hard);
 
   if (priv->codec_data) {
      free (priv->codec_data);
+     priv->codec_data = NULL;
      priv->codec_data_len = 0;
      priv->codec_data_injected = FALSE;
   }
+  /* codec data is gone, same caps must be parsed again */
+  gst_caps_replace (&priv->caps, NULL);
   GST_INFO_OBJECT (sink, "decoder reset hard %d", hard);
 }
 
+/* next decoder could not be set up, but setcaps already switched the
+ * stream config to next stream. Restart the current decoder like a
+ * flush does, keeping the new codec data, tail of current stream is lost
+ */
+static void gapless_fallback(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->fd < 0 || priv->flushing_) {
+    GST_OBJECT_UNLOCK (sink);
+    return;
+  }
+  GST_WARNING_OBJECT (sink, "gapless: restart decoder for next stream");
+  restart_decoder (sink, true);
+  set_decoder_eos (priv, FALSE);
+  priv->output_port_config = FALSE;
+  priv->output_start = FALSE;
+  priv->out_preconfigured = FALSE;
+  priv->codec_data_injected = FALSE;
+  GST_OBJECT_UNLOCK (sink);
+}
+
+/* open and configure decoder of next stream while current one drains */
+static void gapless_prepare(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  struct v4l2_fmtdesc *out_formats, *cap_formats;
+  struct v4l2_decoder_cmd cmd = {
+    .cmd = V4L2_DEC_CMD_STOP,
+    .flags = 0,
+  };
+  gint64 start = g_get_monotonic_time ();
+  int fd;
+
+  fd = open_decoder (&out_formats, &cap_formats);
+  g_free (out_formats);
+  g_free (cap_formats);
+  if (fd < 0) {
+    GST_WARNING_OBJECT (sink, "gapless: open next decoder fail");
+    gapless_fallback (sink);
+    return;
+  }
+
+  /* assume same memory type as current stream */
+  if (priv->secure && priv->afbc_active)
+    afbc_fallback (sink, "secure stream");
+  if (v4l_set_secure_mode (fd, priv->es_width, priv->es_height, priv->secure) ||
+      v4l_dec_dw_config (fd, priv->output_format, priv->dw_mode,
+        priv->low_latency, priv->is_2k_only, priv->fr, &priv->hdr,
+        priv->use_ext_ctrls) ||
+      v4l_set_output_format (fd, priv->output_format,
+        priv->es_width, priv->es_height, priv->is_2k_only)) {
+    GST_WARNING_OBJECT (sink, "gapless: config next decoder fail");
+    goto fallback;
+  }
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->fd < 0 || priv->flushing_) {
+    GST_OBJECT_UNLOCK (sink);
+    goto error;
+  }
+  set_decoder_eos (priv, FALSE);
+  if (ioctl (priv->fd, VIDIOC_DECODER_CMD, &cmd)) {
+    GST_ERROR_OBJECT (sink, "V4L2_DEC_CMD_STOP fail %d", errno);
+    GST_OBJECT_UNLOCK (sink);
+    goto fallback;
+  }
+  priv->next_fd = fd;
+  priv->next_secure = priv->secure;
+  priv->gapless_pending = TRUE;
+  GST_OBJECT_UNLOCK (sink);
+
+  GST_INFO_OBJECT (sink, "gapless: next decoder %d ready in %lld us",
+      fd, g_get_monotonic_time () - start);
+  return;
+
+fallback:
+  v4l_unreg_event (fd);
+  close (fd);
+  gapless_fallback (sink);
+  return;
+error:
+  v4l_unreg_event (fd);
+  close (fd);
+}
+
+/* streaming thread, first buffer of next stream */
+static void gapless_handover(GstAmlVsink *sink, gboolean secure)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  gint64 start = g_get_monotonic_time ();
+  gboolean drained;
+
+  drained = wait_drained (priv);
+
+  GST_OBJECT_LOCK (sink);
+  if (priv->flushing_ || !priv->gapless_pending) {
+    GST_OBJECT_UNLOCK (sink);
+    return;
+  }
+  if (!drained)
+    GST_WARNING_OBJECT (sink, "gapless: drain timeout, switch anyway");
+
+  /* displayed buffers are freed on recycle */
+  priv->keep_display = TRUE;
+  stop_decoder (sink);
+
+  pthread_mutex_lock (&priv->res_lock);
+  v4l_unreg_event (priv->fd);
+  close (priv->fd);
+  priv->fd = priv->next_fd;
+  pthread_mutex_unlock (&priv->res_lock);
+  set_decoder_eos (priv, FALSE);
+  priv->next_fd = -1;
+  priv->gapless_pending = FALSE;
+  priv->output_port_config = FALSE;
+  priv->output_start = FALSE;
+  priv->capture_port_config = FALSE;
+  priv->out_preconfigured = (secure == priv->next_secure);
+  /* next decoder was configured from current caps */
+  priv->caps_meta_pending = FALSE;
+  GST_OBJECT_UNLOCK (sink);
+
+  GST_INFO_OBJECT (sink, "gapless: switched to decoder %d in %lld us",
+      priv->fd, g_get_monotonic_time () - start);
+}
+
+/* eos is waited for under output_buffer_lock */
+static void set_decoder_eos(GstAmlVsinkPrivate *priv, gboolean eos)
+{
+  g_mutex_lock (&priv->output_buffer_lock);
+  priv->eos = eos;
+  if (eos)
+    g_cond_signal (&priv->drain_done);
+  g_mutex_unlock (&priv->output_buffer_lock);
+}
+
+/* last frame of current stream pushed to display, false on timeout */
+static gboolean wait_drained(GstAmlVsinkPrivate *priv)
+{
+  gint64 end = g_get_monotonic_time () + 3 * G_TIME_SPAN_SECOND;
+  gboolean drained;
+
+  g_mutex_lock (&priv->output_buffer_lock);
+  while (!priv->eos && !priv->flushing_) {
+    if (!g_cond_wait_until (&priv->drain_done, &priv->output_buffer_lock, end))
+      break;
+  }
+  drained = priv->eos;
+  g_mutex_unlock (&priv->output_buffer_lock);
+  return drained;
+}
+
+/* streaming thread, IDR after metadata only caps change */
+static void caps_meta_apply(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+
+  priv->caps_meta_pending = FALSE;
+  if (v4l_dec_dw_config (priv->fd, priv->output_format,
+        priv->dw_mode, priv->low_latency, priv->is_2k_only,
+        priv->fr, &priv->hdr, priv->use_ext_ctrls))
+    GST_WARNING_OBJECT (sink, "re-apply decoder config fail");
+  else
+    GST_INFO_OBJECT (sink, "decoder config re-applied, fr %d", priv->fr);
+  /* codec data is injected ahead of this IDR if it changed */
+}
+
 static GstStateChangeReturn pause_to_ready(GstAmlVsink *sink)
 {
   GstAmlVsinkPrivate *priv = sink->priv;
@@ -2532,13 +4021,15 @@ static GstStateChangeReturn pause_to_ready(GstAmlVsink *sink)
   pthread_mutex_unlock (&priv->res_lock);
   GST_OBJECT_UNLOCK (sink);
 
-  stop_eos_thread (sink);
   GST_OBJECT_LOCK (sink);
   vsink_reset (sink);
   priv->pause_pts = -1;
-  display_underflow_register_cb(NULL);
+  display_underflow_register_cb(priv->render, NULL);
   GST_OBJECT_UNLOCK (sink);
 
+  frame_checksum_stop (priv->csum);
+  priv->csum = NULL;
+
   return GST_STATE_CHANGE_SUCCESS;
 }
 
@@ -2557,17 +4048,35 @@ gst_aml_vsink_change_state (GstElement * element,
       struct utsname info;
 
       GST_DEBUG_OBJECT(sink, "null to ready");
+      prewarm_join (sink);
       GST_OBJECT_LOCK (sink);
-      /* render init */
-      priv->render = display_engine_start(priv, priv->pip, priv->low_latency);
+      /* render init, reuse prewarmed one if settings did not change */
+      if (priv->prewarm_render &&
+          priv->prewarm_pip == priv->pip &&
+          priv->prewarm_ll == priv->low_latency &&
+          priv->prewarm_shared == priv->shared_display) {
+        priv->render = priv->prewarm_render;
+        priv->prewarm_render = NULL;
+        GST_INFO_OBJECT (sink, "use prewarmed render");
+      } else {
+        if (priv->prewarm_render) {
+          display_engine_stop (priv->prewarm_render);
+          priv->prewarm_render = NULL;
+        }
+        priv->render = display_engine_start(priv, priv->pip,
+            priv->low_latency, priv->shared_display);
+      }
       if (!priv->render) {
         GST_ERROR ("start render fail");
         ret = GST_STATE_CHANGE_FAILURE;
         GST_OBJECT_UNLOCK (sink);
         break;
       }
-      display_engine_register_cb(capture_buffer_recycle);
-      pause_pts_register_cb(pause_pts_arrived);
+      display_engine_register_cb(priv->render, capture_buffer_recycle);
+      pause_pts_register_cb(priv->render, pause_pts_arrived);
+      display_eos_register_cb(priv->render, display_eos_reached);
+      display_set_ll_policy (priv->render, priv->ll_policy, priv->ll_param);
+      display_set_black_frame_mode (priv->render, priv->black_frame_mode);
 
       if (uname(&info) || sscanf(info.release, "%d.%d", &major, &minor) <= 0) {
         GST_DEBUG("get linux version failed");
@@ -2608,6 +4117,14 @@ gst_aml_vsink_change_state (GstElement * element,
     case GST_STATE_CHANGE_PAUSED_TO_READY:
     {
       GST_INFO_OBJECT(sink, "paused to ready");
+      if (priv->low_latency) {
+        struct ll_stats st;
+
+        if (!display_get_ll_stats (priv->render, &st))
+          GST_WARNING_OBJECT (sink, "immediate output shown %llu dropped %llu latency min %llu avg %llu max %llu us",
+              st.shown, st.dropped, st.latency_min_ns / 1000,
+              st.latency_avg_ns / 1000, st.latency_max_ns / 1000);
+      }
       pause_to_ready (sink);
       GST_INFO_OBJECT(sink, "paused to ready done");
       break;
@@ -2625,6 +4142,8 @@ gst_aml_vsink_change_state (GstElement * element,
       GST_OBJECT_LOCK (sink);
       display_engine_stop (priv->render);
       priv->render = NULL;
+      /* prewarmed decoder not used */
+      prewarm_release (priv);
       GST_WARNING("alloc %d rel %d ob_ref %d ob_unref %d",
           priv->cb_alloc_num, priv->cb_rel_num,
           priv->ob_ref_num, priv->ob_unref_num);
@@ -2638,28 +4157,11 @@ gst_aml_vsink_change_state (GstElement * element,
   return ret;
 }
 
-static int capture_buffer_recycle(void* priv_data, void* handle, bool displayed, bool recycled)
+/* back to decoder, or free when port is gone. res_lock held */
+static int release_capture_buffer(GstAmlVsinkPrivate *priv,
+    struct capture_buffer *frame)
 {
-  gint64 frame_ts;
   int ret = 0;
-  struct capture_buffer *frame = handle;
-  GstAmlVsinkPrivate *priv = priv_data;
-
-  if (!frame || !priv) {
-    GST_ERROR ("invalid para %p %p", priv_data, handle);
-    return -1;
-  }
-
-  if (!displayed)
-    priv->dropped_frame_num++;
-  else
-    priv->rendered_frame_num++;
-
-  g_atomic_int_add (&priv->buf_dis_num, -1);
-  pthread_mutex_lock (&priv->res_lock);
-
-  if (recycled)
-    GST_DEBUG ("recycle index %d", frame->buf.index);
 
   if (frame->free_on_recycle) {
     if (frame->drm_frame && frame->drm_frame->destroy(frame->drm_frame)) {
@@ -2683,16 +4185,6 @@ static int capture_buffer_recycle(void* priv_data, void* handle, bool displayed,
     goto exit;
   }
 
-  if (displayed) {
-    uint32_t position_correction;
-    frame_ts = GST_TIMEVAL_TO_TIME(frame->buf.timestamp);
-    priv->position = priv->segment.start + (frame_ts - priv->first_ts);
-    display_get_position_correction(priv->render, &position_correction);
-    // PAL call query position every 20ms, so position add extra 20ms
-    priv->position += (gint64) position_correction * 1000000 / 90 + 20000000;
-    GST_LOG ("frame %lld position %lld, position_correction %u", frame_ts, priv->position, position_correction);
-  }
-
   ret = v4l_queue_capture_buffer(priv->fd, frame);
   if (ret) {
     GST_ERROR ("queue cb fail %d", frame->id);
@@ -2702,10 +4194,235 @@ static int capture_buffer_recycle(void* priv_data, void* handle, bool displayed,
   }
 
 exit:
+  return ret;
+}
+
+static int capture_buffer_recycle(void* priv_data, void* handle, bool displayed, bool recycled)
+{
+  int ret = 0;
+  struct capture_buffer *frame = handle;
+  GstAmlVsinkPrivate *priv = priv_data;
+
+  if (!frame || !priv) {
+    GST_ERROR ("invalid para %p %p", priv_data, handle);
+    return -1;
+  }
+
+  if (!displayed)
+    g_atomic_int_inc (&priv->dropped_frame_num);
+  else
+    g_atomic_int_inc (&priv->rendered_frame_num);
+
+  g_atomic_int_add (&priv->buf_dis_num, -1);
+  pthread_mutex_lock (&priv->res_lock);
+
+  if (recycled)
+    GST_DEBUG ("recycle index %d", frame->buf.index);
+
+  /* checksum_done requeues it */
+  if (__atomic_load_n (&frame->csum_busy, __ATOMIC_ACQUIRE))
+    frame->requeue_deferred = true;
+  else
+    ret = release_capture_buffer (priv, frame);
+
   pthread_mutex_unlock (&priv->res_lock);
   return ret;
 }
 
+/* checksum worker */
+static void checksum_result(void *priv_data, uint64_t pts_ns, uint32_t crc)
+{
+  GstAmlVsink *sink = priv_data;
+  GstStructure *s;
+
+  s = gst_structure_new ("amlvsink-checksum",
+      "pts", G_TYPE_UINT64, (guint64)pts_ns,
+      "crc", G_TYPE_UINT, (guint)crc, NULL);
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink), s));
+}
+
+static void checksum_done(void *priv_data, void *handle)
+{
+  GstAmlVsinkPrivate *priv = ((GstAmlVsink *)priv_data)->priv;
+  struct capture_buffer *frame = handle;
+
+  pthread_mutex_lock (&priv->res_lock);
+  __atomic_store_n (&frame->csum_busy, 0, __ATOMIC_RELEASE);
+  if (frame->requeue_deferred) {
+    frame->requeue_deferred = false;
+    release_capture_buffer (priv, frame);
+  }
+  pthread_mutex_unlock (&priv->res_lock);
+}
+
+/* position of the frame on screen, interpolated from its vblank
+ * timestamp up to the frame duration
+ */
+static gint64 get_position(GstAmlVsinkPrivate *priv)
+{
+  gint64 position = priv->position;
+  guint64 ts, vsync_ns;
+  uint32_t duration;
+
+  if (priv->render &&
+      !display_get_position (priv->render, &ts, &vsync_ns, &duration) &&
+      vsync_ns >= priv->position_epoch) {
+    position = priv->segment.start + (ts - priv->first_ts);
+
+    if (!priv->paused && !priv->avsync_paused) {
+      struct timespec now;
+      gint64 elapsed, max_elapsed;
+
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      elapsed = GST_TIMESPEC_TO_TIME (now) - vsync_ns;
+      elapsed *= priv->rate;
+      max_elapsed = gst_util_uint64_scale_int (duration, GST_SECOND, PTS_90K);
+      /* reverse playback moves back from the frame pts */
+      if (elapsed < 0)
+        position += MAX (elapsed, -max_elapsed);
+      else
+        position += MIN (elapsed, max_elapsed);
+    }
+  }
+  return position;
+}
+
+/* latency added by decoder and display
+ * min: frames held for reordering plus display delay
+ * max: all capture buffers queued plus frames held for fence
+ */
+static void compute_latency(GstAmlVsinkPrivate *priv, GstClockTime *min, GstClockTime *max)
+{
+  GstClockTime frame_dur;
+  uint64_t disp_min = 0, disp_max = 0;
+  uint32_t margin, dpb = 0;
+
+  if (priv->fr > 0)
+    frame_dur = gst_util_uint64_scale_int (GST_SECOND, 100, priv->fr);
+  else
+    frame_dur = GST_SECOND / 60;
+
+  if (priv->render)
+    display_get_latency (priv->render, &disp_min, &disp_max);
+
+  margin = v4l_dec_margin_buffer_number (priv->output_format,
+      priv->is_2k_only, priv->fr);
+  if (priv->cb_num > margin)
+    dpb = priv->cb_num - margin;
+
+  *min = disp_min;
+  if (!priv->low_latency)
+    *min += dpb * frame_dur;
+  *max = disp_max + (dpb + margin) * frame_dur;
+}
+
+/* in/out counts, queues and dw state are taken in one snapshot under
+ * the object lock the streaming thread updates them with, the rest
+ * are independent counters read atomically. Caller must not hold it
+ */
+static GstStructure *build_stats(GstAmlVsinkPrivate *priv)
+{
+  GstStructure *s;
+  struct ll_stats st;
+  gint in_frames, out_frames, dec_queue, dis_queue, ob_available;
+  uint32_t dw_mode;
+  guint64 dw_bw_saved;
+
+  GST_OBJECT_LOCK (priv->sink);
+  in_frames = priv->in_frame_cnt;
+  out_frames = g_atomic_int_get (&priv->out_frame_cnt);
+  dec_queue = g_atomic_int_get (&priv->buf_dec_num);
+  dis_queue = g_atomic_int_get (&priv->buf_dis_num);
+  ob_available = g_atomic_int_get (&priv->ob_available_num);
+  dw_mode = priv->dw_mode;
+  dw_bw_saved = priv->dw_bw_saved;
+  GST_OBJECT_UNLOCK (priv->sink);
+
+  s = gst_structure_new ("amlvsink-stats",
+      "in-frames", G_TYPE_INT, in_frames,
+      "out-frames", G_TYPE_INT, out_frames,
+      "rendered", G_TYPE_INT, g_atomic_int_get (&priv->rendered_frame_num),
+      "dropped", G_TYPE_INT, g_atomic_int_get (&priv->dropped_frame_num),
+      "decoder-queue", G_TYPE_INT, dec_queue,
+      "display-queue", G_TYPE_INT, dis_queue,
+      "output-available", G_TYPE_INT, ob_available,
+      "capture-allocated", G_TYPE_INT, g_atomic_int_get (&priv->cb_alloc_num),
+      "capture-released", G_TYPE_INT, g_atomic_int_get (&priv->cb_rel_num),
+      "dw-mode", G_TYPE_UINT, dw_mode,
+      "dw-bandwidth-saved", G_TYPE_UINT64, dw_bw_saved,
+      "dec-bitrate", G_TYPE_UINT, g_atomic_int_get (&priv->dec_cnt.bit_rate),
+      "dec-frames", G_TYPE_UINT, g_atomic_int_get (&priv->dec_cnt.frame_count),
+      "dec-error-frames", G_TYPE_UINT,
+          g_atomic_int_get (&priv->dec_cnt.error_frame_count),
+      "dec-dropped-frames", G_TYPE_UINT,
+          g_atomic_int_get (&priv->dec_cnt.drop_frame_count),
+      "dec-total-data", G_TYPE_UINT,
+          g_atomic_int_get (&priv->dec_cnt.total_data),
+      "context-switches", G_TYPE_INT,
+          g_atomic_int_get (&priv->dec_csw) + g_atomic_int_get (&priv->dqout_csw),
+      "capture-batches", G_TYPE_INT, g_atomic_int_get (&priv->capture_batches),
+      NULL);
+
+  if (priv->low_latency && priv->render &&
+      !display_get_ll_stats (priv->render, &st))
+    gst_structure_set (s,
+        "ll-shown", G_TYPE_UINT64, st.shown,
+        "ll-dropped", G_TYPE_UINT64, st.dropped,
+        "ll-latency-min", G_TYPE_UINT64, st.latency_min_ns,
+        "ll-latency-avg", G_TYPE_UINT64, st.latency_avg_ns,
+        "ll-latency-max", G_TYPE_UINT64, st.latency_max_ns,
+        NULL);
+  return s;
+}
+
+/* decode thread */
+static void post_stats(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  guint interval = g_atomic_int_get (&priv->stats_interval);
+  gint64 now;
+
+  if (!interval)
+    return;
+  now = g_get_monotonic_time ();
+  if (now < priv->stats_next)
+    return;
+  priv->stats_next = now + (gint64)interval * 1000;
+
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink), build_stats (priv)));
+}
+
+static void update_latency(GstAmlVsink *sink)
+{
+  GstAmlVsinkPrivate *priv = sink->priv;
+  GstClockTime min, max;
+  GstClockTimeDiff dmin, dmax;
+  gboolean changed;
+
+  compute_latency (priv, &min, &max);
+
+  /* called from streaming, event and property threads */
+  GST_OBJECT_LOCK (sink);
+  /* ignore vblank measurement jitter */
+  dmin = GST_CLOCK_DIFF (priv->latency_min, min);
+  dmax = GST_CLOCK_DIFF (priv->latency_max, max);
+  changed = ABS (dmin) > GST_MSECOND || ABS (dmax) > GST_MSECOND;
+  if (changed) {
+    priv->latency_min = min;
+    priv->latency_max = max;
+  }
+  GST_OBJECT_UNLOCK (sink);
+  if (!changed)
+    return;
+
+  GST_INFO_OBJECT (sink, "latency changed min %" GST_TIME_FORMAT
+      " max %" GST_TIME_FORMAT, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_latency (GST_OBJECT_CAST (sink)));
+}
+
 static int pause_pts_arrived(void* handle, uint32_t pts)
 {
   GstAmlVsinkPrivate *priv = handle;
@@ -2728,6 +4445,7 @@ static int buffer_underflow_happened(void* handle, uint32_t pts)
   GstAmlVsinkPrivate *priv = handle;
   GstAmlVsink *sink = priv->sink;
   bool new_underflow = FALSE;
+  gint64 position;
 
   GST_WARNING ("Receive underflow %u", pts);
 
@@ -2735,16 +4453,18 @@ static int buffer_underflow_happened(void* handle, uint32_t pts)
       !priv->received_eos && priv->out_frame_cnt) {
     GST_OBJECT_LOCK (sink);
     if (priv->buf_underflow_fired == FALSE) {
-      GST_WARNING_OBJECT (sink, "underflow happend position %lld pts %u", priv->position, pts);
+      /* priv->position only holds the first pts */
+      position = get_position (priv);
+      GST_WARNING_OBJECT (sink, "underflow happend position %lld pts %u", position, pts);
       priv->buf_underflow_fired = TRUE;
       new_underflow = TRUE;
     }
     GST_OBJECT_UNLOCK (sink);
   }
   if (new_underflow) {
-    GST_WARNING_OBJECT (sink, "emit underflow pts signal pos %lld pts %u", priv->position, pts);
+    GST_WARNING_OBJECT (sink, "emit underflow pts signal pos %lld pts %u", position, pts);
     g_signal_emit (G_OBJECT (sink), g_signals[SIGNAL_UNDERFLOW], 0, 2, NULL);
-    GST_WARNING_OBJECT (sink, "emit underflow pts signal pos %lld pts %u done", priv->position, pts);
+    GST_WARNING_OBJECT (sink, "emit underflow pts signal pos %lld pts %u done", position, pts);
   }
   return 0;
 }
@@ -2793,43 +4513,6 @@ static int config_sys_node(const char* path, const char* value)
 }
 #endif
 
-#ifdef DUMP_TO_FILE
-static uint8_t ivf_header[32] = {
-  'D', 'K', 'I', 'F',
-  0x00, 0x00, 0x20, 0x00,
-  'V', 'P', '9', '0',
-  0x80, 0x07, 0x38, 0x04, /* 1920 x 1080 */
-  0x30, 0x76, 0x00, 0x00, /* frame rate */
-  0xe8, 0x03, 0x00, 0x00, /* time scale */
-  0x00, 0x00, 0xff, 0xff, /* # of frames */
-  0x00, 0x00, 0x00, 0x00  /* unused */
-};
-
-static void dump(const char* path, const uint8_t *data, int size, gboolean vp9, int frame_cnt)
-{
-  char name[50];
-  uint8_t frame_header[12] = {0};
-  FILE* fd;
-
-  sprintf(name, "%s%d.dat", path, file_index);
-  fd = fopen(name, "ab");
-
-  if (!fd)
-    return;
-  if (vp9) {
-    if (!frame_cnt)
-      fwrite(ivf_header, 1, 32, fd);
-    frame_header[0] = size & 0xff;
-    frame_header[1] = (size >> 8) & 0xff;
-    frame_header[2] = (size >> 16) & 0xff;
-    frame_header[3] = (size >> 24) & 0xff;
-    fwrite(frame_header, 1, 12, fd);
-  }
-  fwrite(data, 1, size, fd);
-  fclose(fd);
-}
-#endif
-
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
@@ -44,10 +44,18 @@ struct _GstAmlVsink {
 
 struct _GstAmlVsinkClass {
   GstBaseSinkClass     parent_class;
+
+  /* actions */
+  gboolean (*animate_window) (GstAmlVsink *sink, gint x, gint y,
+      gint w, gint h, guint duration, gint easing);
 };
 
 GType gst_aml_vsink_get_type (void);
 
+/* easing of animate-window action signal */
+#define GST_TYPE_AML_VSINK_EASING (gst_aml_vsink_easing_get_type())
+GType gst_aml_vsink_easing_get_type (void);
+
 G_END_DECLS
 
 #endif
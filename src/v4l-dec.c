@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/utsname.h>
 #include <gst/gstinfo.h>
 
 #include "v4l-dec.h"
@@ -40,6 +41,56 @@ GST_DEBUG_CATEGORY_EXTERN(gst_aml_vsink_debug);
 #define EXTRA_CAPTURE_BUFFERS (4)
 static const char* video_dev_name = "/dev/video26";
 
+#define DEC_MODULE_NAME "amvdec_ports"
+
+/* decoder module can be rebuilt and reloaded without a kernel change */
+static gchar *dec_module_version(const char *node)
+{
+  const char *attrs[] = { "srcversion", "version" };
+  gchar *path, *link, *mod;
+  gchar *ver = NULL;
+  int i;
+
+  path = g_strdup_printf ("/sys/class/video4linux/%s/device/driver/module", node);
+  link = g_file_read_link (path, NULL);
+  mod = link ? g_path_get_basename (link) : g_strdup (DEC_MODULE_NAME);
+  g_free (link);
+  g_free (path);
+
+  for (i = 0; i < G_N_ELEMENTS (attrs) && !ver; i++) {
+    path = g_strdup_printf ("/sys/module/%s/%s", mod, attrs[i]);
+    if (g_file_get_contents (path, &ver, NULL, NULL))
+      g_strstrip (ver);
+    g_free (path);
+  }
+  g_free (mod);
+  return ver;
+}
+
+/* identify device node, driver, module and kernel without opening the node */
+gchar *v4l_dec_cache_key(void)
+{
+  struct utsname info;
+  const char *node = strrchr (video_dev_name, '/') + 1;
+  gchar *path, *name = NULL, *ver;
+  gchar *key;
+
+  path = g_strdup_printf ("/sys/class/video4linux/%s/name", node);
+  if (g_file_get_contents (path, &name, NULL, NULL))
+    g_strstrip (name);
+  g_free (path);
+  ver = dec_module_version (node);
+
+  if (uname (&info))
+    memset (&info, 0, sizeof(info));
+
+  key = g_strdup_printf ("%s|%s|%s|%s|%s", video_dev_name,
+      name ? name : "", ver ? ver : "", info.release, info.version);
+  g_free (ver);
+  g_free (name);
+  return key;
+}
+
 int v4l_dec_open(bool sanity_check)
 {
   int fd, rc;
@@ -382,6 +433,7 @@ struct capture_buffer** v4l_setup_capture_port (int fd, uint32_t *buf_cnt,
   struct v4l2_control ctl;
   struct v4l2_requestbuffers reqbuf;
   uint32_t w,h;
+  uint32_t stride[2], offset[2], size[2];
 
 
   memset (&fmt, 0, sizeof(struct v4l2_format));
@@ -412,6 +464,28 @@ struct capture_buffer** v4l_setup_capture_port (int fd, uint32_t *buf_cnt,
     goto exit;
   }
 
+  /* driver pads rows and planes, keep what it reports */
+  for (j = 0; j < 2; j++) {
+    struct v4l2_plane_pix_format *pf =
+      &fmt.fmt.pix_mp.plane_fmt[j < fmt.fmt.pix_mp.num_planes ? j : 0];
+
+    stride[j] = pf->bytesperline ? pf->bytesperline : fmt.fmt.pix_mp.width;
+    offset[j] = 0;
+    size[j] = pf->sizeimage;
+  }
+  if (fmt.fmt.pix_mp.num_planes == 1) {
+    offset[1] = stride[0] * fmt.fmt.pix_mp.height;
+    if (!size[0])
+      size[0] = size[1] = offset[1] * 3 / 2;
+  } else {
+    if (!size[0])
+      size[0] = stride[0] * fmt.fmt.pix_mp.height;
+    if (!size[1])
+      size[1] = stride[1] * ((fmt.fmt.pix_mp.height + 1) / 2);
+  }
+  GST_DEBUG ("capture stride %u/%u size %u/%u uv offset %u",
+      stride[0], stride[1], size[0], size[1], offset[1]);
+
   /* minimium capture buffer number */
   memset( &ctl, 0, sizeof(ctl));
   ctl.id= V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
@@ -490,6 +564,9 @@ struct capture_buffer** v4l_setup_capture_port (int fd, uint32_t *buf_cnt,
       cb[i]->gem_fd[j] = fds[j];
       GST_DEBUG("index %d fd %d", i, fds[j]);
     }
+    memcpy (cb[i]->stride, stride, sizeof(stride));
+    memcpy (cb[i]->offset, offset, sizeof(offset));
+    memcpy (cb[i]->size, size, sizeof(size));
 
     rc = ioctl (fd, VIDIOC_QBUF, buf);
     if (rc) {
@@ -551,7 +628,7 @@ int recycle_capture_port_buffer (int fd, struct capture_buffer **cb, uint32_t nu
   return rel_num;
 }
 
-static int config_margin_buffer_number (uint32_t fmt, bool only_2k, float frame_rate)
+int v4l_dec_margin_buffer_number (uint32_t fmt, bool only_2k, float frame_rate)
 {
   int num = EXTRA_CAPTURE_BUFFERS;
 
@@ -598,7 +675,7 @@ int v4l_dec_dw_config(int fd, uint32_t fmt, uint32_t dw_mode,bool low_latency,
   decParm->parms_status = V4L2_CONFIG_PARM_DECODE_CFGINFO;
   decParm->cfg.double_write_mode = dw_mode;
   decParm->cfg.low_latency_mode = low_latency;
-  decParm->cfg.ref_buf_margin = config_margin_buffer_number(fmt, only_2k, frame_rate);
+  decParm->cfg.ref_buf_margin = v4l_dec_margin_buffer_number(fmt, only_2k, frame_rate);
 
   if (hdr->haveColorimetry || hdr->haveMasteringDisplay ||
       hdr->haveContentLightLevel) {
@@ -749,6 +826,50 @@ int v4l_dec_dw_config(int fd, uint32_t fmt, uint32_t dw_mode,bool low_latency,
   return rc;
 }
 
+int v4l_dec_get_cnt_info(int fd, bool ext_ctrls, struct vdec_cnt *cnt)
+{
+  int rc;
+  struct aml_dec_params *decParm;
+  struct v4l2_streamparm streamparm;
+  struct aml_dec_params params;
+
+  if (ext_ctrls) {
+    struct v4l2_ext_control control;
+    struct v4l2_ext_controls ctrls;
+
+    memset (&params, 0, sizeof(params));
+    params.parms_status = V4L2_CONFIG_PARM_DECODE_CNTINFO;
+    memset (&ctrls, 0, sizeof(ctrls));
+    memset (&control, 0, sizeof(control));
+    control.id = AML_V4L2_DEC_PARMS_CONFIG;
+    control.ptr = &params;
+    control.size = sizeof(params);
+    ctrls.count = 1;
+    ctrls.controls = &control;
+    rc = ioctl (fd, VIDIOC_G_EXT_CTRLS, &ctrls);
+    decParm = &params;
+  } else {
+    memset (&streamparm, 0, sizeof(streamparm));
+    streamparm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    decParm = (struct aml_dec_params*)streamparm.parm.raw_data;
+    decParm->parms_status = V4L2_CONFIG_PARM_DECODE_CNTINFO;
+    rc = ioctl (fd, VIDIOC_G_PARM, &streamparm);
+  }
+  if (rc) {
+    GST_DEBUG ("get cnt info fail %d", errno);
+    return rc;
+  }
+  if (!(decParm->parms_status & V4L2_CONFIG_PARM_DECODE_CNTINFO))
+    return -1;
+
+  cnt->bit_rate = decParm->cnt.bit_rate;
+  cnt->frame_count = decParm->cnt.frame_count;
+  cnt->error_frame_count = decParm->cnt.error_frame_count;
+  cnt->drop_frame_count = decParm->cnt.drop_frame_count;
+  cnt->total_data = decParm->cnt.total_data;
+  return 0;
+}
+
 int v4l_dec_config(int fd, bool secure, uint32_t fmt, uint32_t dw_mode,
     bool is_2k_only, float frame_rate, bool disable_dw_scale, bool ext_ctrls)
 {
@@ -797,7 +918,7 @@ int v4l_dec_config(int fd, bool secure, uint32_t fmt, uint32_t dw_mode,
   decParm->cfg.double_write_mode = dw_mode;
   if (fmt != V4L2_PIX_FMT_MPEG2)
     decParm->cfg.ref_buf_margin =
-      config_margin_buffer_number(fmt, is_2k_only, frame_rate);
+      v4l_dec_margin_buffer_number(fmt, is_2k_only, frame_rate);
   decParm->cfg.metadata_config_flag |= (0 << 12);
   if (!disable_dw_scale)
     decParm->cfg.metadata_config_flag |= (1 << 13);
@@ -923,3 +1044,25 @@ int v4l_queue_capture_buffer(int fd, struct capture_buffer *cb)
   return ret;
 }
 
+bool hdr_meta_equal(const struct hdr_meta *a, const struct hdr_meta *b)
+{
+  int i;
+
+  if (a->haveColorimetry != b->haveColorimetry ||
+      a->haveMasteringDisplay != b->haveMasteringDisplay ||
+      a->haveContentLightLevel != b->haveContentLightLevel)
+    return false;
+  if (a->haveColorimetry)
+    for (i = 0; i < G_N_ELEMENTS (a->Colorimetry); i++)
+      if (a->Colorimetry[i] != b->Colorimetry[i])
+        return false;
+  if (a->haveMasteringDisplay)
+    for (i = 0; i < G_N_ELEMENTS (a->MasteringDisplay); i++)
+      if (a->MasteringDisplay[i] != b->MasteringDisplay[i])
+        return false;
+  if (a->haveContentLightLevel)
+    for (i = 0; i < G_N_ELEMENTS (a->ContentLightLevel); i++)
+      if (a->ContentLightLevel[i] != b->ContentLightLevel[i])
+        return false;
+  return true;
+}
@@ -53,10 +53,17 @@ struct capture_buffer {
   struct v4l2_plane plane[2];
   uint8_t *vaddr[2];
   int gem_fd[2];
+  /* Y/UV layout from capture S_FMT, UV of single plane NV12 is in gem_fd[0] */
+  uint32_t stride[2];
+  uint32_t offset[2];
+  uint32_t size[2];
   bool displayed;
   uint32_t id;
 
   bool free_on_recycle;
+  /* checksum worker reads it, requeue waits */
+  int csum_busy;
+  bool requeue_deferred;
   void *drm_handle;
   struct drm_frame *drm_frame;
 };
@@ -70,6 +77,16 @@ struct hdr_meta {
   int ContentLightLevel[2];
 };
 
+/* decoder side counters, see aml_vdec_cnt_infos */
+struct vdec_cnt {
+  uint32_t bit_rate;
+  uint32_t frame_count;
+  uint32_t error_frame_count;
+  uint32_t drop_frame_count;
+  uint32_t total_data;
+};
+
+gchar *v4l_dec_cache_key(void);
 int v4l_dec_open(bool sanity_check);
 int v4l_reg_event(int fd);
 int v4l_unreg_event(int fd);
@@ -87,11 +104,16 @@ struct capture_buffer** v4l_setup_capture_port (int fd, uint32_t *buf_cnt,
 int recycle_output_port_buffer (int fd, struct output_buffer **ob, uint32_t num);
 int recycle_capture_port_buffer (int fd, struct capture_buffer **cb, uint32_t num);
 
-int v4l_dec_dw_config(int fd, uint32_t fmt, uint32_t dw_mode, bool low_latency, bool only_2k, int frame_rate, bool ext_ctrls);
+int v4l_dec_dw_config(int fd, uint32_t fmt, uint32_t dw_mode, bool low_latency,
+    bool only_2k, int frame_rate, struct hdr_meta *hdr, bool ext_ctrls);
 int v4l_dec_config(int fd, bool secure, uint32_t fmt, uint32_t dw_mode,
-    struct hdr_meta *hdr, bool is_2k_only, float frame_rate, bool disable_dw_scale, bool ext_ctrls);
+    bool is_2k_only, float frame_rate, bool disable_dw_scale, bool ext_ctrls);
+int v4l_dec_margin_buffer_number(uint32_t fmt, bool only_2k, float frame_rate);
 int v4l_set_output_format(int fd, uint32_t format, int w, int h, bool only_2k);
 int v4l_set_secure_mode(int fd, int w, int h, bool secure);
+int v4l_dec_get_cnt_info(int fd, bool ext_ctrls, struct vdec_cnt *cnt);
+/* values only count when their have* flag is set */
+bool hdr_meta_equal(const struct hdr_meta *a, const struct hdr_meta *b);
 
 int v4l_queue_capture_buffer(int fd, struct capture_buffer *cb);
 #endif
@@ -0,0 +1,412 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+/* Replay an amlvsink ES dump (es-dump-location) into amlvsink through
+ * appsrc with the original pts and key flags, and report throughput,
+ * drops and latency of each stage. -f retimes the dump to a synthetic
+ * frame rate, e.g. -r -f 120 or -r -f 240 for high frame rate load.
+ *
+ * amlvsink-replay [-r] [-f fps] [-c caps] [-p prop=value]... <location>-<n>.<ext>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+struct frame {
+  guint64 offset;
+  guint size;
+  GstClockTime pts;
+  gboolean key;
+};
+
+struct replay {
+  GMainLoop *loop;
+  GstElement *pipeline;
+  GstElement *src;
+  GstElement *sink;
+
+  GMappedFile *file;
+  const guint8 *data;
+  gsize len;
+  GArray *frames;
+  gboolean realtime;
+  /* Annex-B dump, bytes ahead of first frame are stream headers */
+  gboolean annexb;
+
+  /* input stage, time blocked in push */
+  gint64 push_start;
+  gint64 push_end;
+  gint64 push_block_max;
+  gint64 push_block_total;
+  /* first frame on screen */
+  gint64 first_frame;
+  /* last push to EOS */
+  gint64 eos;
+  GstStructure *stats;
+  gboolean error;
+};
+
+static gboolean load_index(struct replay *r, const gchar *path)
+{
+  gchar *contents, **lines, **l;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+    g_printerr ("can not read index %s\n", path);
+    return FALSE;
+  }
+
+  r->frames = g_array_new (FALSE, FALSE, sizeof(struct frame));
+  lines = g_strsplit (contents, "\n", -1);
+  for (l = lines; *l; l++) {
+    struct frame f;
+    guint64 idx, pts;
+    int key;
+
+    if (**l == '#' || !**l)
+      continue;
+    if (sscanf (*l, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %u %"
+          G_GUINT64_FORMAT " %d", &idx, &f.offset, &f.size, &pts, &key) != 5)
+      continue;
+    if (f.offset + f.size > r->len) {
+      g_printerr ("frame %" G_GUINT64_FORMAT " beyond end of dump\n", idx);
+      break;
+    }
+    f.pts = pts;
+    f.key = key;
+    g_array_append_val (r->frames, f);
+  }
+  g_strfreev (lines);
+  g_free (contents);
+  return r->frames->len > 0;
+}
+
+/* average frame duration over the pts span, 0 if unknown */
+static GstClockTime avg_duration(struct replay *r, GstClockTime *first)
+{
+  GstClockTime lo = GST_CLOCK_TIME_NONE, hi = 0;
+  guint i, n = r->frames->len;
+
+  for (i = 0; i < n; i++) {
+    struct frame *f = &g_array_index (r->frames, struct frame, i);
+
+    lo = MIN (lo, f->pts);
+    hi = MAX (hi, f->pts);
+  }
+  if (first)
+    *first = lo;
+  if (n < 2 || hi <= lo)
+    return 0;
+  return (hi - lo) / (n - 1);
+}
+
+/* scale pts around the first one so average frame duration is 1/fps,
+ * decode order and reordering are kept
+ */
+static void retime(struct replay *r, gint fps)
+{
+  GstClockTime lo, dur;
+  guint i, n = r->frames->len;
+
+  dur = avg_duration (r, &lo);
+  if (!dur)
+    return;
+  for (i = 0; i < n; i++) {
+    struct frame *f = &g_array_index (r->frames, struct frame, i);
+
+    f->pts = lo + gst_util_uint64_scale (f->pts - lo, GST_SECOND, dur * fps);
+  }
+}
+
+static GstCaps *guess_caps(struct replay *r, const gchar *path)
+{
+  if (g_str_has_suffix (path, ".ivf") && r->len >= 32) {
+    guint32 fourcc = GST_READ_UINT32_LE (r->data + 8);
+    const gchar *mime;
+
+    if (fourcc == GST_MAKE_FOURCC ('V', 'P', '9', '0'))
+      mime = "video/x-vp9";
+    else if (fourcc == GST_MAKE_FOURCC ('A', 'V', '0', '1'))
+      mime = "video/x-av1";
+    else
+      return NULL;
+    return gst_caps_new_simple (mime,
+        "width", G_TYPE_INT, GST_READ_UINT16_LE (r->data + 12),
+        "height", G_TYPE_INT, GST_READ_UINT16_LE (r->data + 14), NULL);
+  }
+  if (g_str_has_suffix (path, ".h264"))
+    return gst_caps_from_string ("video/x-h264, parsed=(boolean)true, "
+        "alignment=(string)au, stream-format=(string)byte-stream");
+  if (g_str_has_suffix (path, ".h265"))
+    return gst_caps_from_string ("video/x-h265, parsed=(boolean)true, "
+        "alignment=(string)au, stream-format=(string)byte-stream");
+  return NULL;
+}
+
+static void first_frame(GstElement *sink, guint arg, gpointer data, gpointer user)
+{
+  struct replay *r = user;
+
+  if (!r->first_frame)
+    r->first_frame = g_get_monotonic_time ();
+}
+
+static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer user)
+{
+  struct replay *r = user;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+  case GST_MESSAGE_EOS:
+    r->eos = g_get_monotonic_time ();
+    g_main_loop_quit (r->loop);
+    break;
+  case GST_MESSAGE_ERROR:
+  {
+    GError *err;
+    gchar *dbg;
+
+    gst_message_parse_error (msg, &err, &dbg);
+    g_printerr ("error: %s (%s)\n", err->message, dbg ? dbg : "");
+    g_error_free (err);
+    g_free (dbg);
+    r->error = TRUE;
+    g_main_loop_quit (r->loop);
+    break;
+  }
+  case GST_MESSAGE_ELEMENT:
+  {
+    const GstStructure *s = gst_message_get_structure (msg);
+
+    if (GST_MESSAGE_SRC (msg) == GST_OBJECT (r->sink) &&
+        gst_structure_has_name (s, "amlvsink-stats")) {
+      if (r->stats)
+        gst_structure_free (r->stats);
+      r->stats = gst_structure_copy (s);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return TRUE;
+}
+
+static gpointer push_thread(gpointer data)
+{
+  struct replay *r = data;
+  GstClockTime dur = avg_duration (r, NULL);
+  guint i;
+
+  r->push_start = g_get_monotonic_time ();
+  for (i = 0; i < r->frames->len; i++) {
+    struct frame *f = &g_array_index (r->frames, struct frame, i);
+    guint64 start = (i || !r->annexb) ? f->offset : 0;
+    GstBuffer *buf;
+    gint64 t;
+
+    /* codec data / headers sit ahead of first frame, IVF has
+     * file and frame headers there instead
+     */
+    buf = gst_buffer_new_allocate (NULL, f->offset + f->size - start, NULL);
+    gst_buffer_fill (buf, 0, r->data + start, f->offset + f->size - start);
+    GST_BUFFER_PTS (buf) = f->pts;
+    if (!f->key)
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    /* pace in decode order, pts order would hold back reference
+     * frames until their display time and starve frames using them
+     */
+    if (r->realtime && dur) {
+      gint64 due = r->push_start + i * dur / GST_USECOND;
+      gint64 now = g_get_monotonic_time ();
+
+      if (due > now)
+        g_usleep (due - now);
+    }
+
+    t = g_get_monotonic_time ();
+    if (gst_app_src_push_buffer (GST_APP_SRC (r->src), buf) != GST_FLOW_OK)
+      break;
+    t = g_get_monotonic_time () - t;
+    r->push_block_total += t;
+    if (t > r->push_block_max)
+      r->push_block_max = t;
+  }
+  r->push_end = g_get_monotonic_time ();
+  gst_app_src_end_of_stream (GST_APP_SRC (r->src));
+  return NULL;
+}
+
+static int get_int(const GstStructure *s, const gchar *name)
+{
+  gint v = 0;
+  guint u;
+
+  if (s && !gst_structure_get_int (s, name, &v) &&
+      gst_structure_get_uint (s, name, &u))
+    v = u;
+  return v;
+}
+
+static void report(struct replay *r)
+{
+  guint n = r->frames->len;
+  gdouble secs = (r->eos - r->push_start) / 1e6;
+  guint64 ll_avg = 0;
+  gint out = get_int (r->stats, "out-frames");
+  gint csw = get_int (r->stats, "context-switches");
+  gint batches = get_int (r->stats, "capture-batches");
+
+  g_print ("frames        %u in %.3f s, %.1f fps\n", n, secs,
+      secs > 0 ? n / secs : 0);
+  g_print ("rendered      %d\n", get_int (r->stats, "rendered"));
+  g_print ("dropped       sink %d decoder %d error %d\n",
+      get_int (r->stats, "dropped"),
+      get_int (r->stats, "dec-dropped-frames"),
+      get_int (r->stats, "dec-error-frames"));
+  g_print ("input         push blocked avg %" G_GINT64_FORMAT " max %"
+      G_GINT64_FORMAT " us\n", n ? r->push_block_total / n : 0,
+      r->push_block_max);
+  if (r->first_frame)
+    g_print ("first frame   %" G_GINT64_FORMAT " us after first push\n",
+        r->first_frame - r->push_start);
+  g_print ("drain         %" G_GINT64_FORMAT " us last push to EOS\n",
+      r->eos - r->push_end);
+  g_print ("ctx switches  %d, %.2f per frame (decode threads)\n", csw,
+      out > 0 ? (gdouble)csw / out : 0);
+  g_print ("capture       %d wakeups, %.2f frames each\n", batches,
+      batches > 0 ? (gdouble)out / batches : 0);
+  if (r->stats && gst_structure_get_uint64 (r->stats, "ll-latency-avg", &ll_avg))
+    g_print ("display       decoder output to flip avg %" G_GUINT64_FORMAT " us\n",
+        ll_avg / 1000);
+}
+
+int main(int argc, char **argv)
+{
+  struct replay r;
+  gchar *caps_str = NULL, **props = NULL, *idx_path, *dot;
+  gboolean realtime = FALSE;
+  gint fps = 0;
+  GOptionEntry entries[] = {
+    { "realtime", 'r', 0, G_OPTION_ARG_NONE, &realtime,
+      "Push one frame per average frame duration instead of as fast as possible", NULL },
+    { "fps", 'f', 0, G_OPTION_ARG_INT, &fps,
+      "Retime dump to this frame rate", "FPS" },
+    { "caps", 'c', 0, G_OPTION_ARG_STRING, &caps_str,
+      "Caps of the dump, needed for .es", "CAPS" },
+    { "prop", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &props,
+      "Set amlvsink property", "NAME=VALUE" },
+    { NULL }
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstCaps *caps;
+  GThread *pusher;
+  gchar **p;
+
+  memset (&r, 0, sizeof(r));
+  ctx = g_option_context_new ("<dump>");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err) || argc != 2) {
+    g_printerr ("%s", g_option_context_get_help (ctx, TRUE, NULL));
+    return 1;
+  }
+  g_option_context_free (ctx);
+  r.realtime = realtime;
+
+  r.file = g_mapped_file_new (argv[1], FALSE, &err);
+  if (!r.file) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  r.data = (const guint8 *)g_mapped_file_get_contents (r.file);
+  r.len = g_mapped_file_get_length (r.file);
+  r.annexb = g_str_has_suffix (argv[1], ".h264") ||
+      g_str_has_suffix (argv[1], ".h265") || g_str_has_suffix (argv[1], ".es");
+
+  dot = strrchr (argv[1], '.');
+  idx_path = g_strdup_printf ("%.*s.idx",
+      (int)(dot ? dot - argv[1] : strlen (argv[1])), argv[1]);
+  if (!load_index (&r, idx_path))
+    return 1;
+  g_free (idx_path);
+
+  caps = caps_str ? gst_caps_from_string (caps_str) : guess_caps (&r, argv[1]);
+  if (!caps) {
+    g_printerr ("unknown format, use --caps\n");
+    return 1;
+  }
+  if (fps > 0) {
+    retime (&r, fps);
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+  }
+
+  r.pipeline = gst_parse_launch ("appsrc name=src format=time block=true "
+      "max-bytes=4194304 ! amlvsink name=sink", &err);
+  if (!r.pipeline) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  r.src = gst_bin_get_by_name (GST_BIN (r.pipeline), "src");
+  r.sink = gst_bin_get_by_name (GST_BIN (r.pipeline), "sink");
+  gst_app_src_set_caps (GST_APP_SRC (r.src), caps);
+  gst_caps_unref (caps);
+  g_object_set (r.sink, "stats-interval", 200, NULL);
+  for (p = props; p && *p; p++) {
+    gchar **kv = g_strsplit (*p, "=", 2);
+
+    if (kv[0] && kv[1])
+      gst_util_set_object_arg (G_OBJECT (r.sink), kv[0], kv[1]);
+    g_strfreev (kv);
+  }
+  g_signal_connect (r.sink, "first-video-frame-callback",
+      G_CALLBACK (first_frame), &r);
+
+  r.loop = g_main_loop_new (NULL, FALSE);
+  gst_bus_add_watch (GST_ELEMENT_BUS (r.pipeline), bus_cb, &r);
+  gst_element_set_state (r.pipeline, GST_STATE_PLAYING);
+
+  pusher = g_thread_new ("replay push", push_thread, &r);
+  g_main_loop_run (r.loop);
+
+  /* final counters, before stop resets them */
+  if (r.stats)
+    gst_structure_free (r.stats);
+  g_object_get (r.sink, "stats", &r.stats, NULL);
+  gst_element_set_state (r.pipeline, GST_STATE_NULL);
+  g_thread_join (pusher);
+  if (!r.eos)
+    r.eos = g_get_monotonic_time ();
+  report (&r);
+
+  if (r.stats)
+    gst_structure_free (r.stats);
+  gst_object_unref (r.src);
+  gst_object_unref (r.sink);
+  gst_object_unref (r.pipeline);
+  g_main_loop_unref (r.loop);
+  g_array_free (r.frames, TRUE);
+  g_mapped_file_unref (r.file);
+  g_strfreev (props);
+  g_free (caps_str);
+  return r.error ? 1 : 0;
+}